@@ -58,13 +58,24 @@ typedef enum {
 } MirrorDirection;
 
 typedef enum {
-	STD_MPEG2 = -1,
-	STD_VC = -1,
 	STD_MPEG4 = 0,
 	STD_H263,
 	STD_AVC,
 	STD_MJPG,
+	/* decoding only, not available on i.MX27 */
+	STD_MPEG2,
+	STD_VC1,
+	STD_DIV3,
+	STD_RV,
 } CodStd;
 
+/* MPEG-4 ASP flavours, see VPU_IOC_MP4_CLASS */
+typedef enum {
+	MP4_CLASS_MPEG4 = 0,
+	MP4_CLASS_DIVX5 = 1,
+	MP4_CLASS_XVID = 2,
+	MP4_CLASS_DIVX4 = 5,
+} Mp4Class;
+
 
 #endif//__MFW_GST_UTILS_H__
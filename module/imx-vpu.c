@@ -24,6 +24,7 @@
 #include <linux/kfifo.h>
 #include <linux/slab.h>
 #include <linux/list.h>
+#include <linux/uio.h>
 #include <linux/stat.h>
 #include <linux/wait.h>
 #include <linux/clk.h>
@@ -47,6 +48,44 @@
 #define	VPU_IOC_ROTATE_MIRROR	_IO(VPU_IOC_MAGIC, 7)
 #define VPU_IOC_CODEC		_IO(VPU_IOC_MAGIC, 8)
 #define VPU_IOC_MJPEG_QUALITY	_IO(VPU_IOC_MAGIC, 9)
+#define VPU_IOC_FRAME_DELAY	_IO(VPU_IOC_MAGIC, 10)
+#define VPU_IOC_PTS		_IOW(VPU_IOC_MAGIC, 11, struct timeval)
+#define VPU_IOC_SKIP		_IO(VPU_IOC_MAGIC, 12)
+#define VPU_IOC_FLUSH		_IO(VPU_IOC_MAGIC, 13)
+#define VPU_IOC_PIC_END		_IO(VPU_IOC_MAGIC, 14)
+#define VPU_IOC_SEQ_CHANGE	_IO(VPU_IOC_MAGIC, 15)
+#define VPU_IOC_MP4_CLASS	_IO(VPU_IOC_MAGIC, 16)
+#define VPU_IOC_SRC_SIZE	_IO(VPU_IOC_MAGIC, 17)
+#define VPU_IOC_IFRAME_ONLY	_IO(VPU_IOC_MAGIC, 18)
+#define VPU_IOC_LOW_LATENCY	_IO(VPU_IOC_MAGIC, 19)
+#define VPU_IOC_OUTPUT_INTERVAL	_IO(VPU_IOC_MAGIC, 20)
+#define VPU_IOC_CANVAS		_IOW(VPU_IOC_MAGIC, 21, struct vpu_canvas)
+
+/* the decoded pictures are written to a tile of a larger canvas */
+struct vpu_canvas {
+	__u32 x, y;		/* position of the tile */
+	__u32 width, height;	/* canvas size, 0 for a picture per buffer */
+};
+
+#define VPU_IOC_SEQ_HINT	_IOW(VPU_IOC_MAGIC, 22, struct vpu_seq_hint)
+
+/* the sequence as parsed by userspace before the VPU has seen it */
+struct vpu_seq_hint {
+	__u32 width, height;	/* coded size, multiples of 16 */
+	__u32 num_ref_frames;
+	struct v4l2_rect visible;
+};
+
+#define VPU_IOC_WRITEV		_IOWR(VPU_IOC_MAGIC, 23, struct vpu_writev)
+
+/* bitstream in pieces, written as far as it fits like with write() */
+struct vpu_writev {
+	struct iovec __user *iov;
+	__u32 count;
+	__u32 written;		/* returned: bytes taken from the start */
+};
+
+#define VPU_IOC_HAS_CODEC	_IO(VPU_IOC_MAGIC, 24)
 
 #define VPU_NUM_INSTANCE	4
 
@@ -119,6 +158,10 @@ enum {
 #define STD_H263	1
 #define STD_AVC		2
 #define STD_MJPG	3
+#define STD_MPEG2	4
+#define STD_VC1		5
+#define STD_DIV3	6
+#define STD_RV		7
 
 static int vpu_v1_codecs[VPU_CODEC_MAX] = {
 	[VPU_CODEC_AVC_DEC] = 2,
@@ -170,6 +213,7 @@ struct vpu_regs {
 	u32 fmo_slice_save_buf_size;
 	u32 bit_pic_width_mask;
 	u32 ret_dec_pic_option;
+	u32 ret_dec_pic_cur_idx;	/* 0 if the decoded index isn't reported */
 	u32 para_buf_size;
 	u32 code_buf_size;
 	u32 work_buf_size;
@@ -204,6 +248,7 @@ static struct vpu_regs regs_v2 = {
 	.fmo_slice_save_buf_size = 32,
 	.bit_pic_width_mask = 0xffff,
 	.ret_dec_pic_option = 0x1d4,
+	.ret_dec_pic_cur_idx = RET_DEC_PIC_CUR_IDX,
 	.para_buf_size = 10 * 1024,
 	.code_buf_size = 200 * 1024,
 	.work_buf_size = (512 * 1024) + (32 * 1024 * 8),
@@ -261,12 +306,20 @@ struct memalloc_record {
 };
 
 #define VPU_MAX_FB	10
+#define VPU_MAX_PTS	32
+#define VPU_MAX_AU	32
+
+struct vpu_pts {
+	unsigned int	offset;	/* bitstream position the timestamp applies from */
+	ktime_t		ts;
+};
 
 struct vpu_instance {
 	struct vpu *vpu;
 	int idx;
 	int width, height;
 	int num_fb;
+	int frame_delay;	/* pictures held back for reordering */
 	int format;
 	struct vb2_queue vidq;
 	int in_use;
@@ -287,13 +340,39 @@ struct vpu_instance {
 	u32 framerate;
 	u32 gopsize;
 	u32 rotmir;
+	u32 pixelformat;	/* layout of the decoded pictures */
 	int hold;
 	int newdata;
+	int skip_nonref;	/* skip non-reference pictures, downstream is late */
+	int skipping;		/* current PIC_RUN may skip */
+	int iframe_only;	/* skip all but intra pictures */
+	int low_latency;	/* stream needs no display reordering */
+	int output_interval;	/* output only every nth picture */
+	unsigned int output_seq;	/* pictures decoded for output so far */
+	int decimating;		/* current PIC_RUN picture is not output */
+	int au_mode;		/* userspace signals complete pictures */
+	int au_pending;		/* complete pictures not yet decoded */
+	unsigned int au_end;	/* end of the last complete picture */
+	/* ends of the complete JPEG pictures not yet decoded */
+	unsigned int au_ends[VPU_MAX_AU];
+	unsigned int au_in, au_out;
 	wait_queue_head_t waitq;
 	int needs_init;
+	int needs_flush;	/* bitstream pointers must be reset */
+	int needs_seq_end;	/* a new sequence follows, re-run SEQ_INIT */
+	/* SEQ_INIT is to find this sequence, frame buffers are set up for it */
+	struct vpu_seq_hint hint;
+	int preallocating;	/* frame buffers for the hint are allocated */
 
 	ktime_t		frametime, frame_duration;
 
+	/* timestamps of bitstream data not yet consumed by the VPU */
+	struct vpu_pts	pts[VPU_MAX_PTS];
+	unsigned int	pts_in, pts_out;
+	/* timestamps of decoded pictures not yet output, sorted */
+	ktime_t		pts_pending[VPU_MAX_PTS];
+	int		num_pts_pending;
+
 	struct memalloc_record rec[VPU_MAX_FB];
 
 	int mode;
@@ -304,6 +383,15 @@ struct vpu_instance {
 	int		buffered_size;
 	int		flushing;
 	int		standard;
+	int		mp4_class;
+	/* visible part of the decoded pictures, before rotation */
+	struct v4l2_rect crop;
+	/* window of interest set by userspace, after rotation */
+	struct v4l2_rect roi;
+	/* capture buffers shared with other instances as a mosaic */
+	struct vpu_canvas canvas;
+	/* picture size for streams without sequence header (DivX 3) */
+	int		src_width, src_height;
 	unsigned int	readofs, fifo_in, fifo_out;
 
 	u32		*mjpg_huf_table;
@@ -376,12 +464,71 @@ static int vpu_fifo_out(struct vpu_instance *instance, int len)
 	return 0;
 }
 
+/* The timestamp applies to the data written next */
+static void vpu_pts_add(struct vpu_instance *instance, ktime_t ts)
+{
+	struct vpu_pts *p;
+
+	/* drop the oldest entry if userspace gets too far ahead */
+	if (instance->pts_in - instance->pts_out == VPU_MAX_PTS)
+		instance->pts_out++;
+
+	p = &instance->pts[instance->pts_in % VPU_MAX_PTS];
+	p->offset = instance->fifo_in;
+	p->ts = ts;
+	instance->pts_in++;
+}
+
+/*
+ * Move the timestamps of all data the VPU has consumed to the pending
+ * list. Pictures come out in display order, so the smallest pending
+ * timestamp belongs to the next picture output.
+ */
+static void vpu_pts_consume(struct vpu_instance *instance)
+{
+	while (instance->pts_in != instance->pts_out) {
+		struct vpu_pts *p = &instance->pts[instance->pts_out % VPU_MAX_PTS];
+		int i;
+
+		if ((int)(instance->fifo_out - p->offset) <= 0)
+			break;
+
+		if (instance->num_pts_pending == VPU_MAX_PTS) {
+			instance->num_pts_pending--;
+			memmove(&instance->pts_pending[0], &instance->pts_pending[1],
+				instance->num_pts_pending * sizeof(ktime_t));
+		}
+
+		i = instance->num_pts_pending++;
+		while (i > 0 && ktime_to_ns(instance->pts_pending[i - 1]) >
+				ktime_to_ns(p->ts)) {
+			instance->pts_pending[i] = instance->pts_pending[i - 1];
+			i--;
+		}
+		instance->pts_pending[i] = p->ts;
+
+		instance->pts_out++;
+	}
+}
+
+static int vpu_pts_get(struct vpu_instance *instance, ktime_t *ts)
+{
+	if (!instance->num_pts_pending)
+		return -ENOENT;
+
+	*ts = instance->pts_pending[0];
+	instance->num_pts_pending--;
+	memmove(&instance->pts_pending[0], &instance->pts_pending[1],
+		instance->num_pts_pending * sizeof(ktime_t));
+
+	return 0;
+}
+
 static int vpu_fifo_in(struct vpu_instance *instance, const char __user *ubuf, size_t len)
 {
 	struct vpu *vpu = instance->vpu;
 	struct vpu_regs *regs = vpu->regs;
 	unsigned int off, l;
-	int ret;
 
 	len = min(vpu_fifo_avail(instance) - 1, len);
 
@@ -389,18 +536,53 @@ static int vpu_fifo_in(struct vpu_instance *instance, const char __user *ubuf, s
 
 	l = min(len, regs->bitstream_buf_size - off);
 
-	ret = copy_from_user(instance->bitstream_buf + off, ubuf, l);
-	if (ret)
-		return ret;
-	ret = copy_from_user(instance->bitstream_buf, ubuf + l, len - l);
-	if (ret)
-		return ret;
+	if (copy_from_user(instance->bitstream_buf + off, ubuf, l))
+		return -EFAULT;
+	if (copy_from_user(instance->bitstream_buf, ubuf + l, len - l))
+		return -EFAULT;
 
 	instance->fifo_in += len;
 
 	return len;
 }
 
+/* Copy the pieces in order for as long as they fit, returns the bytes taken */
+static int vpu_fifo_in_iov(struct vpu_instance *instance,
+		const struct iovec *iov, unsigned long count)
+{
+	unsigned long i;
+	int ret, len = 0;
+
+	for (i = 0; i < count; i++) {
+		if (!iov[i].iov_len)
+			continue;
+
+		ret = vpu_fifo_in(instance, iov[i].iov_base, iov[i].iov_len);
+		if (ret < 0)
+			return len ? len : ret;
+
+		len += ret;
+		if (ret < iov[i].iov_len)
+			break;
+	}
+
+	return len;
+}
+
+/* Let the VPU pick up the data written, called with the lock held */
+static void vpu_dec_kick(struct vpu_instance *instance)
+{
+	struct vpu *vpu = instance->vpu;
+
+	/* in access unit mode VPU_IOC_PIC_END starts decoding */
+	if (!instance->au_mode || instance->flushing) {
+		instance->hold = 0;
+		instance->newdata = 1;
+
+		queue_work(vpu->workqueue, &vpu->work);
+	}
+}
+
 static ssize_t show_info(struct device *dev,
 			    struct device_attribute *attr, char *buf)
 {
@@ -527,32 +709,62 @@ static void vpu_bit_issue_command(struct vpu_instance *instance, int cmd)
 
 	vpu_write(vpu, BIT_RUN_INDEX, instance->idx);
 	vpu_write(vpu, BIT_RUN_COD_STD, vpu->drvdata->codecs[instance->format]);
+	/* DivX 3 runs on the MPEG-4 decoder, the register is shared */
+	if (vpu->drvdata->version == 2)
+		vpu_write(vpu, V2_BIT_RUN_AUX_STD,
+				instance->format == VPU_CODEC_DV3_DEC ? 1 : 0);
 	vpu_write(vpu, BIT_RUN_COMMAND, cmd);
 }
 
+/* size of one chroma plane, JPEG pictures may come with 4:2:2 */
+static int vpu_chroma_size(struct vpu_instance *instance)
+{
+	int size = (instance->width / 2) * (instance->height / 2);
+
+	return instance->pixelformat == V4L2_PIX_FMT_YUV422P ? size * 2 : size;
+}
+
+/*
+ * Frame buffers allocated ahead of SEQ_INIT from a sequence hint are
+ * kept if they are large enough.
+ */
+static int vpu_fb_alloc(struct memalloc_record *rec, int size)
+{
+	if (rec->cpu_addr && rec->size >= size)
+		return 0;
+
+	if (rec->cpu_addr)
+		dma_free_coherent(NULL, rec->size, rec->cpu_addr,
+				rec->dma_addr);
+
+	rec->cpu_addr = dma_alloc_coherent(NULL, size, &rec->dma_addr,
+			GFP_DMA | GFP_KERNEL);
+	if (!rec->cpu_addr)
+		return -ENOMEM;
+	rec->size = size;
+
+	return 0;
+}
+
 static int vpu_alloc_fb_v1(struct vpu_instance *instance)
 {
 	struct vpu *vpu = instance->vpu;
 	int i, ret = 0;
-	int size = (instance->width * instance->height * 3) / 2;
+	int chroma = vpu_chroma_size(instance);
+	int size = instance->width * instance->height + 2 * chroma;
 	u32 *para_buf = instance->para_buf;
 
 	for (i = 0; i < instance->num_fb; i++) {
 		struct memalloc_record *rec = &instance->rec[i];
 
-		rec->cpu_addr = dma_alloc_coherent(NULL, size, &rec->dma_addr,
-					       GFP_DMA | GFP_KERNEL);
-		if (!rec->cpu_addr) {
-			ret = -ENOMEM;
+		ret = vpu_fb_alloc(rec, size);
+		if (ret)
 			goto out;
-		}
-		rec->size = size;
 
 		/* Let the codec know the addresses of the frame buffers. */
 		para_buf[i * 3] = rec->dma_addr;
 		para_buf[i * 3 + 1] = rec->dma_addr + instance->width * instance->height;
-		para_buf[i * 3 + 2] = para_buf[i * 3 + 1] +
-			(instance->width / 2) * (instance->height / 2);
+		para_buf[i * 3 + 2] = para_buf[i * 3 + 1] + chroma;
 	}
 out:
 	if (ret)
@@ -564,7 +776,8 @@ static int vpu_alloc_fb_v2(struct vpu_instance *instance)
 {
 	struct vpu *vpu = instance->vpu;
 	int i, ret = 0;
-	int size = (instance->width * instance->height * 3) / 2;
+	int chroma = vpu_chroma_size(instance);
+	int size = instance->width * instance->height + 2 * chroma;
 	unsigned long *para_buf = instance->para_buf;
 	int height = instance->height;
 	int stridey = instance->width;
@@ -573,15 +786,9 @@ static int vpu_alloc_fb_v2(struct vpu_instance *instance)
 	size += mvsize;
 
 	for (i = 0; i < instance->num_fb + 1; i++) {
-		struct memalloc_record *rec = &instance->rec[i];
-
-		rec->cpu_addr = dma_alloc_coherent(NULL, size, &rec->dma_addr,
-						       GFP_DMA | GFP_KERNEL);
-		if (!rec->cpu_addr) {
-			ret = -ENOMEM;
+		ret = vpu_fb_alloc(&instance->rec[i], size);
+		if (ret)
 			goto out;
-		}
-		rec->size = size;
 	}
 
 	for (i = 0; i < instance->num_fb; i+=2) {
@@ -589,21 +796,18 @@ static int vpu_alloc_fb_v2(struct vpu_instance *instance)
 
 		para_buf[i * 3] = rec->dma_addr + instance->width * instance->height; /* Cb */
 		para_buf[i * 3 + 1] = rec->dma_addr; /* Y */
-		para_buf[i * 3 + 3] = para_buf[i * 3] +
-			(instance->width / 2) * (instance->height / 2); /* Cr */
+		para_buf[i * 3 + 3] = para_buf[i * 3] + chroma; /* Cr */
 		if (instance->standard == STD_AVC)
-			para_buf[96 + i + 1] = para_buf[i * 3 + 3] +
-				(instance->width / 2) * (instance->height / 2);
+			para_buf[96 + i + 1] = para_buf[i * 3 + 3] + chroma;
 
 		if (i + 1 < instance->num_fb) {
 			para_buf[i * 3 + 2] = instance->rec[i + 1].dma_addr; /* Y */
 			para_buf[i * 3 + 5] = instance->rec[i + 1].dma_addr +
 				instance->width * instance->height ; /* Cb */
-			para_buf[i * 3 + 4] = para_buf[i * 3 + 5] +
-				(instance->width / 2) * (instance->height / 2); /* Cr */
+			para_buf[i * 3 + 4] = para_buf[i * 3 + 5] + chroma; /* Cr */
 		}
 		if (instance->standard == STD_AVC)
-			para_buf[96 + i] = para_buf[i * 3 + 4] + (instance->width / 2) * (instance->height / 2);
+			para_buf[96 + i] = para_buf[i * 3 + 4] + chroma;
 	}
 	if (instance->standard == STD_MPEG4) {
 		para_buf[97] = instance->rec[instance->num_fb].dma_addr;
@@ -1070,6 +1274,72 @@ enum {
     MP4_DIVX4 = 5,
 };
 
+static int vpu_dec_codec(int std)
+{
+	switch (std) {
+	case STD_MPEG4:
+	case STD_H263:
+		return VPU_CODEC_MP4_DEC;
+	case STD_AVC:
+		return VPU_CODEC_AVC_DEC;
+	case STD_MJPG:
+		return VPU_CODEC_MJPG_DEC;
+	case STD_MPEG2:
+		return VPU_CODEC_MP2_DEC;
+	case STD_VC1:
+		return VPU_CODEC_VC1_DEC;
+	case STD_DIV3:
+		return VPU_CODEC_DV3_DEC;
+	case STD_RV:
+		return VPU_CODEC_RV_DEC;
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * JPEG and DivX 3 have no start codes to find the end of a picture. The
+ * firmware decodes one complete picture per run, userspace marks the
+ * picture ends with VPU_IOC_PIC_END.
+ */
+static int vpu_dec_chunked(int std)
+{
+	return std == STD_MJPG || std == STD_DIV3;
+}
+
+/* whether the firmware is told to output pictures in display order */
+static int vpu_dec_reorders(struct vpu_instance *instance)
+{
+	return instance->vpu->drvdata->version == 2 && !instance->low_latency;
+}
+
+/* frame buffers the firmware is expected to ask for */
+static int vpu_hint_num_fb(struct vpu_instance *instance)
+{
+	/* the i.MX5 firmware takes one more for MPEG-4 */
+	return min_t(int, instance->hint.num_ref_frames + 2, VPU_MAX_FB - 1);
+}
+
+/*
+ * Return the queued capture buffers with an error, userspace finds the
+ * actual picture size with VIDIOC_G_FMT.
+ */
+static void vpu_dec_fail_capture(struct vpu_instance *instance)
+{
+	struct vpu *vpu = instance->vpu;
+	struct vpu_buffer *vbuf, *tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vpu->lock, flags);
+	list_for_each_entry_safe(vbuf, tmp, &vpu->queued, list) {
+		if (vb2_get_drv_priv(vbuf->vb.vb2_queue) != instance)
+			continue;
+		list_del_init(&vbuf->list);
+		vb2_buffer_done(&vbuf->vb, VB2_BUF_STATE_ERROR);
+	}
+	spin_unlock_irqrestore(&vpu->lock, flags);
+}
+
 static int noinline vpu_dec_get_initial_info(struct vpu_instance *instance)
 {
 	struct vpu *vpu = instance->vpu;
@@ -1078,17 +1348,10 @@ static int noinline vpu_dec_get_initial_info(struct vpu_instance *instance)
 	u64 f;
 	int ret;
 
-	switch (instance->standard) {
-	case STD_MPEG4:
-	case STD_H263:
-		instance->format = VPU_CODEC_MP4_DEC;
-		break;
-	case STD_AVC:
-		instance->format = VPU_CODEC_AVC_DEC;
-		break;
-	default:
+	ret = vpu_dec_codec(instance->standard);
+	if (ret < 0 || vpu->drvdata->codecs[ret] < 0)
 		return -EINVAL;
-	};
+	instance->format = ret;
 
 	vpu_write(vpu, BIT_PARA_BUF_ADDR, instance->para_buf_phys);
 
@@ -1101,16 +1364,32 @@ static int noinline vpu_dec_get_initial_info(struct vpu_instance *instance)
 	vpu_write(vpu, CMD_DEC_SEQ_BB_START, instance->bitstream_buf_phys);
 	vpu_write(vpu, CMD_DEC_SEQ_START_BYTE, instance->bitstream_buf_phys);
 	vpu_write(vpu, CMD_DEC_SEQ_BB_SIZE, regs->bitstream_buf_size / 1024);
-	vpu_write(vpu, CMD_DEC_SEQ_OPTION, 0);
+	/*
+	 * The v2 firmware holds pictures back until it knows their display
+	 * order. Streams without B pictures don't need that in low latency
+	 * mode. The v1 firmware has no such option.
+	 */
+	vpu_write(vpu, CMD_DEC_SEQ_OPTION,
+			vpu_dec_reorders(instance) ? DEC_SEQ_OPT_REORDER_EN : 0);
 	if (instance->format == VPU_CODEC_AVC_DEC) {
 		vpu_write(vpu, CMD_DEC_SEQ_PS_BB_START, instance->ps_mem_buf_phys);
 		vpu_write(vpu, CMD_DEC_SEQ_PS_BB_SIZE, (PS_SAVE_SIZE / 1024));
 	}
 	if (instance->format == VPU_CODEC_MP4_DEC) {
-		vpu_write(vpu, CMD_DEC_SEQ_MP4_ASP_CLASS, MP4_MPEG4);
+		vpu_write(vpu, CMD_DEC_SEQ_MP4_ASP_CLASS, instance->mp4_class);
 	}
-
-	vpu_write(vpu, V2_BIT_RUN_AUX_STD, 0);
+	/* DivX 3 has no sequence header, the size comes from the container */
+	if (instance->format == VPU_CODEC_DV3_DEC) {
+		vpu_write(vpu, CMD_DEC_SEQ_SRC_SIZE,
+				instance->src_width << regs->bit_pic_width_offset |
+				instance->src_height);
+	}
+	/*
+	 * The firmware takes the Huffman and quantization tables from the
+	 * JPEG headers of every picture, see vpu_dec_start_frame.
+	 */
+	if (instance->format == VPU_CODEC_MJPG_DEC)
+		vpu_write(vpu, CMD_DEC_SEQ_JPG_THUMB_EN, 0);
 
 	vpu_write(vpu, BIT_BUSY_FLAG, 0x1);
 	vpu_bit_issue_command(instance, SEQ_INIT);
@@ -1134,6 +1413,11 @@ static int noinline vpu_dec_get_initial_info(struct vpu_instance *instance)
 	instance->width = ((val >> regs->bit_pic_width_offset) & regs->bit_pic_width_mask);
 	instance->height = (val & regs->bit_pic_width_mask);
 
+	instance->crop.left = 0;
+	instance->crop.top = 0;
+	instance->crop.width = instance->width;
+	instance->crop.height = instance->height;
+
 	instance->width = ROUND_UP_16(instance->width);
 	instance->height = ROUND_UP_16(instance->height);
 	dev_dbg(vpu->dev, "%s instance %d now: %dx%d\n", __func__, instance->idx,
@@ -1141,8 +1425,13 @@ static int noinline vpu_dec_get_initial_info(struct vpu_instance *instance)
 
 	val = vpu_read(vpu, RET_DEC_SEQ_SRC_F_RATE);
 	dev_dbg(vpu->dev, "%s: Framerate: 0x%08x\n", __func__, val);
+	/* in low latency mode nothing is held back for reordering */
+	if (vpu->drvdata->version == 2 && instance->low_latency)
+		instance->frame_delay = 0;
+	else
+		instance->frame_delay = vpu_read(vpu, RET_DEC_SEQ_FRAME_DELAY);
 	dev_dbg(vpu->dev, "%s: frame delay: %d\n", __func__,
-			vpu_read(vpu, RET_DEC_SEQ_FRAME_DELAY));
+			instance->frame_delay);
 	f = val & 0xffff;
 	f *= 1000;
 	do_div(f, (val >> 16) + 1);
@@ -1153,25 +1442,52 @@ static int noinline vpu_dec_get_initial_info(struct vpu_instance *instance)
 		return -EINVAL;
 	}
 
+	/*
+	 * The capture queue may already be set up for the hinted sequence.
+	 * If the stream disagrees the SEQ_INIT values win, the frame
+	 * buffers are reallocated below and userspace sets up the capture
+	 * queue again.
+	 */
+	if (instance->hint.width) {
+		if (instance->width != instance->hint.width ||
+				instance->height != instance->hint.height) {
+			dev_info(vpu->dev, "%s: stream is %dx%d, not %dx%d as hinted\n",
+					__func__, instance->width, instance->height,
+					instance->hint.width, instance->hint.height);
+			memset(&instance->hint, 0, sizeof(instance->hint));
+			vpu_dec_fail_capture(instance);
+		} else {
+			/* more frame buffers than needed don't hurt */
+			instance->num_fb = max(instance->num_fb,
+					vpu_hint_num_fb(instance));
+		}
+	}
+
+	/* the SPS frame cropping, in units of two pixels */
 	if (instance->format == VPU_CODEC_AVC_DEC) {
-		int top, right;
+		int left, right, top, bottom;
+
 		val = vpu_read(vpu, RET_DEC_SEQ_CROP_LEFT_RIGHT);
 		val2 = vpu_read(vpu, RET_DEC_SEQ_CROP_TOP_BOTTOM);
 
-		dev_dbg(vpu->dev, "crop left:  %d\n", ((val >> 10) & 0x3FF) * 2);
-		dev_dbg(vpu->dev, "crop top:   %d\n", ((val2 >> 10) & 0x3FF) * 2);
-
-		if (val == 0 && val2 == 0) {
-			right = 0;
-			top = 0;
-		} else {
-			right = instance->width - ((val & 0x3FF) * 2);
-			top = instance->height - ((val2 & 0x3FF) * 2);
+		left = ((val >> 10) & 0x3FF) * 2;
+		right = (val & 0x3FF) * 2;
+		top = ((val2 >> 10) & 0x3FF) * 2;
+		bottom = (val2 & 0x3FF) * 2;
+
+		if (left + right < instance->crop.width &&
+				top + bottom < instance->crop.height) {
+			instance->crop.left = left;
+			instance->crop.top = top;
+			instance->crop.width -= left + right;
+			instance->crop.height -= top + bottom;
 		}
-		dev_dbg(vpu->dev, "crop right: %d\n", right);
-		dev_dbg(vpu->dev, "crop top:   %d\n", top);
 	}
 
+	dev_dbg(vpu->dev, "%s: visible %dx%d at %d,%d\n", __func__,
+			instance->crop.width, instance->crop.height,
+			instance->crop.left, instance->crop.top);
+
 	/* access normal registers */
 	vpu_write(vpu, CMD_DEC_SEQ_INIT_ESCAPE, 0);
 
@@ -1197,6 +1513,7 @@ static int noinline vpu_dec_get_initial_info(struct vpu_instance *instance)
 	}
 
 	instance->needs_init = 0;
+	memset(&instance->hint, 0, sizeof(instance->hint));
 
 out:
 	if (ret)
@@ -1214,6 +1531,7 @@ static void noinline vpu_enc_start_frame(struct vpu_instance *instance)
 	int ustride;
 	unsigned long u;
 
+	vpu_write(vpu, BIT_FRAME_MEM_CTRL, 0);
 	vpu_write(vpu, CMD_ENC_PIC_ROT_MODE, 0x10);
 
 	vpu_write(vpu, CMD_ENC_PIC_QS, 30);
@@ -1231,22 +1549,105 @@ static void noinline vpu_enc_start_frame(struct vpu_instance *instance)
 	vpu_bit_issue_command(instance, PIC_RUN);
 }
 
-static void vpu_dec_start_frame(struct vpu_instance *instance)
+/*
+ * Account for the bitstream data the VPU has consumed so far. Returns
+ * the number of bytes consumed since the last call.
+ */
+static unsigned int vpu_dec_update_readofs(struct vpu_instance *instance)
 {
 	struct vpu *vpu = instance->vpu;
 	struct vpu_regs *regs = vpu->regs;
-	dma_addr_t dma;
-	int height, stridey;
-	unsigned int readofs;
+	unsigned int readofs, len;
+
+	/* chunked pictures are consumed as a whole, see vpu_dec_chunk_done */
+	if (vpu_dec_chunked(instance->standard))
+		return 0;
 
 	readofs = vpu_read(vpu, BIT_RD_PTR(instance->idx)) -
 			instance->bitstream_buf_phys;
 
-	vpu_fifo_out(instance, (readofs - instance->readofs) % regs->bitstream_buf_size);
+	len = (readofs - instance->readofs) % regs->bitstream_buf_size;
+	vpu_fifo_out(instance, len);
 	instance->readofs = readofs;
 
+	return len;
+}
+
+static unsigned int vpu_dec_chunk_done(struct vpu_instance *instance)
+{
+	struct vpu_regs *regs = instance->vpu->regs;
+	unsigned int end = instance->au_ends[instance->au_out % VPU_MAX_AU];
+	unsigned int len = end - instance->fifo_out;
+
+	instance->au_out++;
+	vpu_fifo_out(instance, len);
+	instance->readofs = end % regs->bitstream_buf_size;
+
+	return len;
+}
+
+/*
+ * Planes of the tile in a canvas. The canvas has the layout of a single
+ * picture of the canvas size, the tile is placed at its offset in every
+ * plane.
+ */
+static void vpu_dec_canvas_addr(struct vpu_instance *instance,
+		dma_addr_t *y, dma_addr_t *u, dma_addr_t *v)
+{
+	struct vpu_canvas *c = &instance->canvas;
+	int cy = instance->pixelformat == V4L2_PIX_FMT_YUV422P ? 1 : 2;
+	dma_addr_t ubase, vbase;
+
+	ubase = *y + c->width * c->height;
+	vbase = ubase + (c->width / 2) * (c->height / cy);
+
+	*y += c->y * c->width + c->x;
+	if (instance->pixelformat == V4L2_PIX_FMT_NV12) {
+		*u = ubase + (c->y / 2) * c->width + c->x;
+		*v = *u;
+	} else {
+		*u = ubase + (c->y / cy) * (c->width / 2) + c->x / 2;
+		*v = vbase + (c->y / cy) * (c->width / 2) + c->x / 2;
+	}
+}
+
+static void vpu_dec_start_frame(struct vpu_instance *instance)
+{
+	struct vpu *vpu = instance->vpu;
+	struct vpu_regs *regs = vpu->regs;
+	dma_addr_t dma, u, v;
+	int height, stridey;
+	unsigned int wrofs;
+	u32 option = 0;
+
+	vpu_dec_update_readofs(instance);
+
+	/*
+	 * Without knowing where a picture ends the firmware has to wait for
+	 * the start of the next one. In access unit mode only complete
+	 * pictures are handed to the VPU, so prescan is not needed.
+	 */
+	if (instance->au_mode && !instance->flushing) {
+		wrofs = instance->au_end;
+	} else {
+		wrofs = instance->fifo_in;
+		option |= DEC_PIC_OPT_PRESCAN_EN;
+	}
+
 	vpu_write(vpu, BIT_WR_PTR(instance->idx),
-			instance->bitstream_buf_phys + (instance->fifo_in % regs->bitstream_buf_size));
+			instance->bitstream_buf_phys + (wrofs % regs->bitstream_buf_size));
+
+	if (vpu_dec_chunked(instance->standard)) {
+		unsigned int start = instance->fifo_out % regs->bitstream_buf_size;
+
+		vpu_write(vpu, CMD_DEC_PIC_CHUNK_SIZE,
+				instance->au_ends[instance->au_out % VPU_MAX_AU] -
+				instance->fifo_out);
+		vpu_write(vpu, CMD_DEC_PIC_BB_START,
+				instance->bitstream_buf_phys + (start & ~3));
+		vpu_write(vpu, CMD_DEC_PIC_START_BYTE, start & 3);
+		option &= ~DEC_PIC_OPT_PRESCAN_EN;
+	}
 
 	instance->newdata = 0;
 
@@ -1259,17 +1660,60 @@ static void vpu_dec_start_frame(struct vpu_instance *instance)
 	}
 
 	dma = vb2_dma_contig_plane_paddr(&vpu->active->vb, 0);
+	if (instance->canvas.width) {
+		vpu_dec_canvas_addr(instance, &dma, &u, &v);
+		stridey = instance->canvas.width;
+	} else {
+		u = dma + stridey * height;
+		if (instance->pixelformat == V4L2_PIX_FMT_YUV422P)
+			v = u + (stridey / 2) * height;
+		else
+			v = u + (stridey / 2) * (height / 2);
+	}
+
+	/*
+	 * The frame memory control is shared by all instances, the chroma
+	 * layout has to be set for every picture.
+	 */
+	switch (instance->pixelformat) {
+	case V4L2_PIX_FMT_NV12:
+		vpu_write(vpu, BIT_FRAME_MEM_CTRL, FRAME_MEM_CTRL_CBCR_INTERLEAVE);
+		break;
+	case V4L2_PIX_FMT_YVU420:
+		swap(u, v);
+		/* fall through */
+	default:
+		vpu_write(vpu, BIT_FRAME_MEM_CTRL, 0);
+		break;
+	}
 
 	/* Set rotator output */
 	vpu_write(vpu, CMD_DEC_PIC_ROT_ADDR_Y, dma);
-	vpu_write(vpu, CMD_DEC_PIC_ROT_ADDR_CB, dma + stridey * height);
-	vpu_write(vpu, CMD_DEC_PIC_ROT_ADDR_CR,
-		dma + stridey * height + (stridey / 2) * (height / 2));
+	vpu_write(vpu, CMD_DEC_PIC_ROT_ADDR_CB, u);
+	vpu_write(vpu, CMD_DEC_PIC_ROT_ADDR_CR, v);
 	vpu_write(vpu, CMD_DEC_PIC_ROT_STRIDE, stridey);
-	vpu_write(vpu, CMD_DEC_PIC_ROT_MODE, instance->rotmir);
 
-	vpu_write(vpu, CMD_DEC_PIC_OPTION, 1); /* Enable prescan */
-	vpu_write(vpu, CMD_DEC_PIC_SKIP_NUM, 0);
+	/*
+	 * Pictures dropped by the output interval stay in the frame buffers
+	 * of the VPU, the rotator doesn't copy them to the capture buffer.
+	 */
+	instance->decimating = instance->output_interval > 1 &&
+			instance->output_seq % instance->output_interval;
+	vpu_write(vpu, CMD_DEC_PIC_ROT_MODE,
+			instance->decimating ? 0 : instance->rotmir);
+
+	/*
+	 * Let the firmware drop non-reference pictures without decoding
+	 * them, or all but intra pictures for trick play.
+	 */
+	instance->skipping = instance->iframe_only || instance->skip_nonref;
+	if (instance->iframe_only)
+		option |= DEC_PIC_OPT_SKIP_NON_I;
+	else if (instance->skipping)
+		option |= DEC_PIC_OPT_SKIP_NON_REF;
+
+	vpu_write(vpu, CMD_DEC_PIC_OPTION, option);
+	vpu_write(vpu, CMD_DEC_PIC_SKIP_NUM, instance->skipping);
 
 	vpu_write(vpu, V2_BIT_AXI_SRAM_USE, 0);
 
@@ -1277,6 +1721,98 @@ static void vpu_dec_start_frame(struct vpu_instance *instance)
 	vpu_bit_issue_command(instance, PIC_RUN);
 }
 
+/*
+ * Discard all bitstream data and return the queued capture buffers of
+ * the instance. The picture currently decoded, if any, is returned by
+ * the interrupt handler. Caller must hold vpu->lock
+ */
+static void vpu_dec_discard(struct vpu_instance *instance)
+{
+	struct vpu *vpu = instance->vpu;
+	struct vpu_buffer *vbuf, *tmp;
+
+	list_for_each_entry_safe(vbuf, tmp, &vpu->queued, list) {
+		if (vb2_get_drv_priv(vbuf->vb.vb2_queue) != instance)
+			continue;
+		if (vbuf == vpu->active)
+			continue;
+		list_del_init(&vbuf->list);
+		vb2_buffer_done(&vbuf->vb, VB2_BUF_STATE_ERROR);
+	}
+
+	instance->fifo_in = 0;
+	instance->fifo_out = 0;
+	instance->readofs = 0;
+	instance->pts_in = 0;
+	instance->pts_out = 0;
+	instance->num_pts_pending = 0;
+	instance->au_pending = 0;
+	instance->au_end = 0;
+	instance->au_in = 0;
+	instance->au_out = 0;
+	instance->skip_nonref = 0;
+	instance->output_seq = 0;
+	instance->flushing = 0;
+	instance->newdata = 0;
+	instance->hold = 1;
+
+	/* the hardware is reset from vpu_work before the next PIC_RUN */
+	if (!instance->needs_init)
+		instance->needs_flush = 1;
+
+	wake_up_interruptible(&instance->waitq);
+}
+
+static void vpu_dec_flush(struct vpu_instance *instance)
+{
+	struct vpu *vpu = instance->vpu;
+
+	vpu_write(vpu, BIT_BUSY_FLAG, 0x1);
+	vpu_bit_issue_command(instance, DEC_BUF_FLUSH);
+	if (vpu_wait(vpu))
+		dev_dbg(vpu->dev, "%s: flushing instance %d failed\n", __func__,
+				instance->idx);
+
+	vpu_write(vpu, BIT_RD_PTR(instance->idx), instance->bitstream_buf_phys);
+	vpu_write(vpu, BIT_WR_PTR(instance->idx), instance->bitstream_buf_phys);
+	vpu_write(vpu, BIT_FRM_DIS_FLG(instance->idx), 0);
+
+	instance->needs_flush = 0;
+}
+
+static void vpu_free_fb(struct vpu_instance *instance)
+{
+	int i;
+
+	for (i = 0; i < VPU_MAX_FB; i++) {
+		struct memalloc_record *rec = &instance->rec[i];
+		if (rec->cpu_addr)
+			dma_free_coherent(NULL, rec->size, rec->cpu_addr,
+					rec->dma_addr);
+		rec->cpu_addr = NULL;
+	}
+}
+
+/*
+ * The frame buffers are sized for the old sequence. End it so that the
+ * next SEQ_INIT can pick up the new picture size.
+ */
+static void vpu_dec_seq_end(struct vpu_instance *instance)
+{
+	struct vpu *vpu = instance->vpu;
+
+	vpu_write(vpu, BIT_BUSY_FLAG, 0x1);
+	vpu_bit_issue_command(instance, SEQ_END);
+	if (vpu_wait(vpu))
+		dev_dbg(vpu->dev, "%s: ending sequence of instance %d failed\n",
+				__func__, instance->idx);
+
+	vpu_free_fb(instance);
+
+	instance->needs_seq_end = 0;
+	instance->needs_init = 1;
+}
+
 /*
  * This is the single point of action. Once we start decoding
  * a frame and wait for the corresponding interrupt we are not
@@ -1294,8 +1830,15 @@ static void vpu_work(struct work_struct *work)
 	while (1) {
 		for (i = 0; i < VPU_NUM_INSTANCE; i++) {
 			instance = &vpu->instance[i];
+			if (instance->in_use && instance->needs_flush)
+				vpu_dec_flush(instance);
+			if (instance->in_use && instance->needs_seq_end)
+				vpu_dec_seq_end(instance);
 			if (instance->in_use && !instance->hold && instance->needs_init) {
-				if (instance->mode == VPU_MODE_ENCODER)
+				/* retried once the hinted frame buffers are there */
+				if (instance->preallocating)
+					ret = -EAGAIN;
+				else if (instance->mode == VPU_MODE_ENCODER)
 					ret = vpu_enc_get_initial_info(instance);
 				else
 					ret = vpu_dec_get_initial_info(instance);
@@ -1318,6 +1861,19 @@ static void vpu_work(struct work_struct *work)
 		if (!vpu->active)
 			return;
 
+		/* nothing to decode without a complete picture */
+		if (instance->mode == VPU_MODE_DECODER &&
+				vpu_dec_chunked(instance->standard) &&
+				instance->au_in == instance->au_out) {
+			if (instance->flushing) {
+				list_del_init(&vpu->active->list);
+				vb2_buffer_done(&vpu->active->vb,
+						VB2_BUF_STATE_ERROR);
+			}
+			instance->hold = 1;
+			continue;
+		}
+
 		ktime_get_ts(&s);
 
 		instance->start_time = timespec_to_ns(&s);
@@ -1337,10 +1893,46 @@ static void vpu_dec_irq_handler(struct vpu *vpu, struct vpu_instance *instance,
 	struct vpu_regs *regs = vpu->regs;
 
 	struct vpu_buffer *buf = to_vpu_vb(vb);
+	enum vb2_buffer_state state = VB2_BUF_STATE_DONE;
+	unsigned int consumed;
+	ktime_t ts;
+
+	/* The bitstream this picture was decoded from has been discarded */
+	if (instance->needs_flush) {
+		vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
+		list_del_init(&buf->list);
+		wake_up_interruptible(&instance->waitq);
+		return;
+	}
+
+	if (vpu_dec_chunked(instance->standard)) {
+		consumed = vpu_dec_chunk_done(instance);
+		/* a picture end slot is free again, see vpu_poll() */
+		wake_up_interruptible(&instance->waitq);
+	} else {
+		consumed = vpu_dec_update_readofs(instance);
+	}
+	vpu_pts_consume(instance);
+
+	if (instance->au_mode && consumed) {
+		if (instance->au_pending)
+			instance->au_pending--;
+		if (!instance->au_pending && !instance->flushing)
+			instance->hold = 1;
+	}
+
+	/*
+	 * A run without output may just be the reorder delay. Only for a
+	 * picture the firmware reports as skipped one timestamp less is
+	 * needed, skipped pictures are never reordered behind others.
+	 */
+	if (instance->skipping && consumed &&
+			(int)vpu_read(vpu, regs->ret_dec_pic_cur_idx) == -2)
+		vpu_pts_get(instance, &ts);
 
 	if (!vpu_read(vpu, regs->ret_dec_pic_option)) {
 		if (instance->flushing) {
-			vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
+			state = VB2_BUF_STATE_ERROR;
 		} else {
 			vb2_buffer_done(vb, VB2_BUF_STATE_QUEUED);
 
@@ -1349,12 +1941,25 @@ static void vpu_dec_irq_handler(struct vpu *vpu, struct vpu_instance *instance,
 
 			return;
 		}
-	} else
-		vb2_buffer_done(vb, VB2_BUF_STATE_DONE);
+	} else if (instance->decimating) {
+		/* the capture buffer stays active for the next picture */
+		instance->output_seq++;
+		vpu_pts_get(instance, &instance->frametime);
+		instance->frametime = ktime_add(instance->frame_duration,
+				instance->frametime);
+		vpu_write(vpu, BIT_FRM_DIS_FLG(instance->idx), 0);
+		vb2_buffer_done(vb, VB2_BUF_STATE_QUEUED);
+		return;
+	} else {
+		instance->output_seq++;
+		/* without timestamps from userspace keep counting frames */
+		vpu_pts_get(instance, &instance->frametime);
+	}
 
 	vpu_write(vpu, BIT_FRM_DIS_FLG(instance->idx), 0);
 	list_del_init(&buf->list);
 
+	/* userspace may dequeue the buffer as soon as it is done */
 	vb->v4l2_buf.timestamp = ktime_to_timeval(instance->frametime);
 	instance->frametime = ktime_add(instance->frame_duration,
 			instance->frametime);
@@ -1362,6 +1967,8 @@ static void vpu_dec_irq_handler(struct vpu *vpu, struct vpu_instance *instance,
 	vb->v4l2_buf.field = vpu->field;
 	vb->v4l2_buf.sequence = vpu->sequence++;
 
+	vb2_buffer_done(vb, state);
+
 	wake_up_interruptible(&instance->waitq);
 }
 
@@ -1398,11 +2005,12 @@ static void vpu_enc_irq_handler(struct vpu *vpu, struct vpu_instance *instance,
 	instance->num_frames++;
 
 	list_del_init(&buf->list);
-	vb2_buffer_done(vb, VB2_BUF_STATE_DONE);
 
 	vb->v4l2_buf.field = vpu->field;
 	vb->v4l2_buf.sequence = vpu->sequence++;
 
+	vb2_buffer_done(vb, VB2_BUF_STATE_DONE);
+
 	wake_up_interruptible(&instance->waitq);
 }
 
@@ -1462,12 +2070,32 @@ static int vpu_open(struct file *file)
 	instance->in_use = 1;
 	instance->idx = i;
 	instance->needs_init = 1;
+	instance->needs_flush = 0;
+	instance->needs_seq_end = 0;
 	instance->headersize = 0;
 	instance->header = NULL;
 	instance->mode = VPU_MODE_DECODER;
 	instance->standard = STD_MPEG4;
 	instance->format = VPU_CODEC_AVC_DEC;
+	instance->mp4_class = MP4_MPEG4;
+	instance->src_width = 0;
+	instance->src_height = 0;
+	memset(&instance->roi, 0, sizeof(instance->roi));
+	memset(&instance->canvas, 0, sizeof(instance->canvas));
+	memset(&instance->hint, 0, sizeof(instance->hint));
+	instance->preallocating = 0;
+	instance->pixelformat = V4L2_PIX_FMT_YUV420;
 	instance->hold = 1;
+	instance->skip_nonref = 0;
+	instance->iframe_only = 0;
+	instance->low_latency = 0;
+	instance->output_interval = 1;
+	instance->output_seq = 0;
+	instance->au_mode = 0;
+	instance->au_pending = 0;
+	instance->au_end = 0;
+	instance->au_in = 0;
+	instance->au_out = 0;
 	instance->flushing = 0;
 	instance->readofs = 0;
 	instance->fifo_in = 0;
@@ -1480,6 +2108,9 @@ static int vpu_open(struct file *file)
 	memset(instance->rec, 0, sizeof(instance->rec));
 
 	instance->frametime = ktime_set(0, 0);
+	instance->pts_in = 0;
+	instance->pts_out = 0;
+	instance->num_pts_pending = 0;
 
 	init_waitqueue_head(&instance->waitq);
 
@@ -1537,6 +2168,7 @@ static long vpu_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct vpu_instance *instance = file->private_data;
 	int ret = 0;
 	u32 std;
+	struct timeval tv;
 
 	switch (cmd) {
 	case VPU_IOC_ROTATE_MIRROR:
@@ -1558,14 +2190,270 @@ static long vpu_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			instance->standard = std;
 			instance->mjpg_quality = 50;
 			break;
+		case STD_MPEG2:
+		case STD_VC1:
+		case STD_DIV3:
+		case STD_RV:
+			/* decoders of the v2 VPU only */
+			if (instance->vpu->drvdata->codecs[vpu_dec_codec(std)] < 0) {
+				ret = -EINVAL;
+				break;
+			}
+			instance->standard = std;
+			break;
 		default:
 			ret = -EINVAL;
 			break;
 		}
 		break;
+	case VPU_IOC_HAS_CODEC:
+		/* whether VPU_IOC_CODEC takes the standard, without setting it */
+		std = (u32)arg;
+		if (vpu_dec_codec(std) < 0 ||
+				instance->vpu->drvdata->codecs[vpu_dec_codec(std)] < 0)
+			ret = -EINVAL;
+		break;
 	case VPU_IOC_MJPEG_QUALITY:
 		instance->mjpg_quality = (u32)arg;
 		break;
+	case VPU_IOC_MP4_CLASS:
+		switch ((u32)arg) {
+		case MP4_MPEG4:
+		case MP4_DIVX5_HIGHER:
+		case MP4_XVID:
+		case MP4_DIVX4:
+			instance->mp4_class = (u32)arg;
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+		}
+		break;
+	case VPU_IOC_SRC_SIZE:
+		/* width in the upper, height in the lower 16 bits */
+		instance->src_width = ((u32)arg >> 16) & 0xffff;
+		instance->src_height = (u32)arg & 0xffff;
+		break;
+	case VPU_IOC_PTS:
+		if (copy_from_user(&tv, (void __user *)arg, sizeof(tv))) {
+			ret = -EFAULT;
+			break;
+		}
+		spin_lock_irq(&instance->vpu->lock);
+		vpu_pts_add(instance, timeval_to_ktime(tv));
+		spin_unlock_irq(&instance->vpu->lock);
+		break;
+	case VPU_IOC_SKIP:
+		/* stays in effect until switched off again */
+		if (arg && !instance->vpu->regs->ret_dec_pic_cur_idx) {
+			ret = -EINVAL;
+			break;
+		}
+		spin_lock_irq(&instance->vpu->lock);
+		instance->skip_nonref = !!arg;
+		spin_unlock_irq(&instance->vpu->lock);
+		break;
+	case VPU_IOC_IFRAME_ONLY:
+		/* skipped pictures can't be told from the reorder delay */
+		if (arg && !instance->vpu->regs->ret_dec_pic_cur_idx) {
+			ret = -EINVAL;
+			break;
+		}
+		spin_lock_irq(&instance->vpu->lock);
+		instance->iframe_only = !!arg;
+		spin_unlock_irq(&instance->vpu->lock);
+		break;
+	case VPU_IOC_LOW_LATENCY:
+		/* takes effect with the next sequence initialisation */
+		instance->low_latency = !!arg;
+		break;
+	case VPU_IOC_CANVAS: {
+		struct vpu_canvas canvas;
+
+		if (copy_from_user(&canvas, (void __user *)arg, sizeof(canvas))) {
+			ret = -EFAULT;
+			break;
+		}
+		/* plane addresses of the tile have to stay 8 byte aligned */
+		if (canvas.width && (canvas.width % 16 || canvas.height % 2 ||
+				canvas.x % 16 || canvas.y % 2 ||
+				canvas.width > 4096 || canvas.height > 4096)) {
+			ret = -EINVAL;
+			break;
+		}
+		if (instance->mode != VPU_MODE_DECODER ||
+				vb2_is_streaming(&instance->vidq)) {
+			ret = -EBUSY;
+			break;
+		}
+		instance->canvas = canvas;
+		break;
+	}
+	case VPU_IOC_SEQ_HINT: {
+		struct vpu_seq_hint hint;
+		struct v4l2_rect *v = &hint.visible;
+
+		if (copy_from_user(&hint, (void __user *)arg, sizeof(hint))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (!hint.width || !hint.height || hint.width % 16 ||
+				hint.height % 16 || hint.width > 4096 ||
+				hint.height > 4096 || v->left < 0 || v->top < 0 ||
+				!v->width || !v->height ||
+				v->left + v->width > hint.width ||
+				v->top + v->height > hint.height) {
+			ret = -EINVAL;
+			break;
+		}
+
+		/* only before SEQ_INIT has started on the bitstream */
+		spin_lock_irq(&instance->vpu->lock);
+		if (instance->mode != VPU_MODE_DECODER || !instance->needs_init ||
+				instance->needs_seq_end || !instance->hold ||
+				instance->preallocating ||
+				vb2_is_streaming(&instance->vidq)) {
+			spin_unlock_irq(&instance->vpu->lock);
+			ret = -EBUSY;
+			break;
+		}
+		instance->hint = hint;
+		instance->width = hint.width;
+		instance->height = hint.height;
+		instance->crop = hint.visible;
+		instance->preallocating = 1;
+		spin_unlock_irq(&instance->vpu->lock);
+
+		/*
+		 * Allocate the frame buffers now, SEQ_INIT keeps them if the
+		 * stream matches. Userspace can set up the capture queue
+		 * meanwhile, VIDIOC_G_FMT reports the hinted size.
+		 */
+		instance->num_fb = vpu_hint_num_fb(instance);
+		ret = instance->vpu->drvdata->alloc_fb(instance);
+
+		spin_lock_irq(&instance->vpu->lock);
+		if (ret) {
+			/* SEQ_INIT allocates them as usual */
+			memset(&instance->hint, 0, sizeof(instance->hint));
+			instance->width = 0;
+			instance->height = 0;
+		}
+		instance->preallocating = 0;
+		if (instance->fifo_in) {
+			instance->hold = 0;
+			queue_work(instance->vpu->workqueue, &instance->vpu->work);
+		}
+		spin_unlock_irq(&instance->vpu->lock);
+		break;
+	}
+	case VPU_IOC_OUTPUT_INTERVAL:
+		if (!arg) {
+			ret = -EINVAL;
+			break;
+		}
+		spin_lock_irq(&instance->vpu->lock);
+		instance->output_interval = (u32)arg;
+		instance->output_seq = 0;
+		spin_unlock_irq(&instance->vpu->lock);
+		break;
+	case VPU_IOC_FLUSH:
+		if (instance->mode != VPU_MODE_DECODER) {
+			ret = -EINVAL;
+			break;
+		}
+		spin_lock_irq(&instance->vpu->lock);
+		vpu_dec_discard(instance);
+		spin_unlock_irq(&instance->vpu->lock);
+		break;
+	case VPU_IOC_WRITEV: {
+		struct vpu_writev wv;
+		struct iovec *iov;
+
+		if (copy_from_user(&wv, (void __user *)arg, sizeof(wv))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (instance->mode != VPU_MODE_DECODER || !wv.count ||
+				wv.count > UIO_MAXIOV) {
+			ret = -EINVAL;
+			break;
+		}
+		iov = memdup_user(wv.iov, wv.count * sizeof(*iov));
+		if (IS_ERR(iov)) {
+			ret = PTR_ERR(iov);
+			break;
+		}
+
+		/* all pieces go in under one lock acquisition */
+		spin_lock_irq(&instance->vpu->lock);
+		ret = vpu_fifo_in_iov(instance, iov, wv.count);
+		if (ret >= 0)
+			vpu_dec_kick(instance);
+		spin_unlock_irq(&instance->vpu->lock);
+		kfree(iov);
+		if (ret < 0)
+			break;
+
+		if (put_user(ret, &((struct vpu_writev __user *)arg)->written))
+			ret = -EFAULT;
+		else
+			ret = 0;
+		break;
+	}
+	case VPU_IOC_PIC_END:
+		if (instance->mode != VPU_MODE_DECODER) {
+			ret = -EINVAL;
+			break;
+		}
+		spin_lock_irq(&instance->vpu->lock);
+		if (vpu_dec_chunked(instance->standard)) {
+			if (instance->au_in - instance->au_out >= VPU_MAX_AU) {
+				spin_unlock_irq(&instance->vpu->lock);
+				ret = -ENOSPC;
+				break;
+			}
+			instance->au_ends[instance->au_in++ % VPU_MAX_AU] =
+				instance->fifo_in;
+		}
+		instance->au_mode = 1;
+		instance->au_pending++;
+		instance->au_end = instance->fifo_in;
+		instance->hold = 0;
+		instance->newdata = 1;
+		queue_work(instance->vpu->workqueue, &instance->vpu->work);
+		spin_unlock_irq(&instance->vpu->lock);
+		break;
+	case VPU_IOC_SEQ_CHANGE:
+		/*
+		 * The firmware doesn't report a new sequence header while
+		 * decoding. Userspace drains the decoder, stops streaming and
+		 * tells us, the bitstream following belongs to the new sequence.
+		 */
+		if (instance->mode != VPU_MODE_DECODER) {
+			ret = -EINVAL;
+			break;
+		}
+		if (instance->vidq.streaming) {
+			ret = -EBUSY;
+			break;
+		}
+		spin_lock_irq(&instance->vpu->lock);
+		vpu_dec_discard(instance);
+		if (!instance->needs_init)
+			instance->needs_seq_end = 1;
+		instance->width = 0;
+		instance->height = 0;
+		memset(&instance->hint, 0, sizeof(instance->hint));
+		queue_work(instance->vpu->workqueue, &instance->vpu->work);
+		spin_unlock_irq(&instance->vpu->lock);
+		break;
+	case VPU_IOC_FRAME_DELAY:
+		if (instance->needs_init)
+			ret = -EAGAIN;
+		else
+			ret = instance->frame_delay;
+		break;
 	default:
 		ret = video_ioctl2(file, cmd, arg);
 		break;
@@ -1578,7 +2466,6 @@ static int vpu_release(struct file *file)
 	struct vpu_instance *instance = file->private_data;
 	struct vpu *vpu = instance->vpu;
 	struct vpu_regs *regs = vpu->regs;
-	int i;
 
 	if (instance->videobuf_init) {
 		vb2_queue_release(&instance->vidq);
@@ -1594,12 +2481,7 @@ static int vpu_release(struct file *file)
 	dma_free_coherent(NULL, PS_SAVE_SIZE, instance->ps_mem_buf,
 			instance->ps_mem_buf_phys);
 
-	for (i = 0; i < VPU_MAX_FB; i++) {
-		struct memalloc_record *rec = &instance->rec[i];
-		if (rec->cpu_addr)
-			dma_free_coherent(NULL, rec->size, rec->cpu_addr,
-					rec->dma_addr);
-	}
+	vpu_free_fb(instance);
 
 	instance->in_use = 0;
 	instance->width = 0;
@@ -1620,7 +2502,6 @@ static ssize_t vpu_write_stream(struct file *file, const char __user *ubuf, size
 		loff_t *off)
 {
 	struct vpu_instance *instance = file->private_data;
-	struct vpu *vpu = instance->vpu;
 	int ret = 0;
 
 	if (instance->mode != VPU_MODE_DECODER)
@@ -1633,10 +2514,7 @@ static ssize_t vpu_write_stream(struct file *file, const char __user *ubuf, size
 	else
 		instance->flushing = 1;
 
-	instance->hold = 0;
-	instance->newdata = 1;
-
-	queue_work(vpu->workqueue, &vpu->work);
+	vpu_dec_kick(instance);
 
 	spin_unlock_irq(&instance->vpu->lock);
 
@@ -1787,7 +2665,7 @@ static int vpu_program_firmware(struct vpu *vpu)
 	return 0;
 }
 
-static int frame_calc_size(int width, int height)
+static int frame_calc_size(int width, int height, u32 pixelformat)
 {
 #if 0
 	int ystride, ustride, vstride, size;
@@ -1802,8 +2680,22 @@ static int frame_calc_size(int width, int height)
 
 	return size;
 #endif
+	if (pixelformat == V4L2_PIX_FMT_YUV422P)
+		return width * height * 2;
+
 	return (width * height * 3) / 2;
 }
+
+/* a capture buffer holds a picture or the whole canvas */
+static int vpu_capture_size(struct vpu_instance *instance)
+{
+	if (instance->canvas.width)
+		return frame_calc_size(instance->canvas.width,
+				instance->canvas.height, instance->pixelformat);
+
+	return frame_calc_size(instance->width, instance->height,
+			instance->pixelformat);
+}
 #if LINUX_VERSION_CODE > KERNEL_VERSION(3, 1, 0)
 static int vpu_vb2_setup(struct vb2_queue *q, const struct v4l2_format *fmt,
 		unsigned int *count, unsigned int *num_planes,
@@ -1820,7 +2712,7 @@ static int vpu_vb2_setup(struct vb2_queue *q,
 	*num_planes = 1;
 	vpu->sequence = 0;
 	alloc_ctxs[0] = vpu->alloc_ctx;
-	sizes[0] = frame_calc_size(instance->width, instance->height);
+	sizes[0] = vpu_capture_size(instance);
 
 	return 0;
 }
@@ -1830,7 +2722,19 @@ static int vpu_vb2_prepare(struct vb2_buffer *vb)
 	struct vb2_queue *q = vb->vb2_queue;
 	struct vpu_instance *instance = vb2_get_drv_priv(q);
 
-	size_t new_size = frame_calc_size(instance->width, instance->height);
+	size_t new_size = vpu_capture_size(instance);
+	struct vpu_canvas *c = &instance->canvas;
+	int w = instance->width, h = instance->height;
+
+	if (instance->rotmir & 0x1)
+		swap(w, h);
+
+	/* the tile has to fit into the canvas */
+	if (c->width && (c->x + w > c->width || c->y + h > c->height)) {
+		dev_err(instance->vpu->vdev->dev.parent, "%dx%d tile at %d,%d exceeds %dx%d canvas\n",
+			w, h, c->x, c->y, c->width, c->height);
+		return -EINVAL;
+	}
 
 	if (vb2_plane_size(vb, 0) < new_size) {
 		dev_err(instance->vpu->vdev->dev.parent, "Buffer too small (%lu < %zu)\n",
@@ -1925,6 +2829,9 @@ static int vpu_reqbufs(struct file *file, void *priv,
 	/* Initialize videobuf queue as per the buffer type */
 	q->type = reqbuf->type;
 	q->io_modes = VB2_MMAP | VB2_USERPTR;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 8, 0)
+	q->io_modes |= VB2_DMABUF;
+#endif
 	q->drv_priv = instance;
 	q->ops = &vpu_videobuf_ops;
 	q->mem_ops = &vb2_dma_contig_memops;
@@ -1958,6 +2865,20 @@ static int vpu_dqbuf (struct file *file, void *priv, struct v4l2_buffer *p)
 	return vb2_dqbuf(&instance->vidq, p, file->f_flags & O_NONBLOCK);
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 8, 0)
+/*
+ * Capture buffers are physically contiguous, so the IPU, the GPU or
+ * another V4L2 device can take them as they are.
+ */
+static int vpu_expbuf(struct file *file, void *priv,
+		struct v4l2_exportbuffer *eb)
+{
+	struct vpu_instance *instance = file->private_data;
+
+	return vb2_expbuf(&instance->vidq, eb);
+}
+#endif
+
 static int vpu_g_fmt_vid_cap(struct file *file, void *priv,
 				struct v4l2_format *fmt)
 {
@@ -1977,12 +2898,248 @@ static int vpu_g_fmt_vid_cap(struct file *file, void *priv,
 
 	fmt->fmt.pix.width = width;
 	fmt->fmt.pix.height = height;
-	fmt->fmt.pix.sizeimage = frame_calc_size(width,height);
-	fmt->fmt.pix.pixelformat = V4L2_PIX_FMT_YVU420;
+	fmt->fmt.pix.bytesperline = width;
+	fmt->fmt.pix.sizeimage = frame_calc_size(width, height,
+			instance->pixelformat);
+	fmt->fmt.pix.pixelformat = instance->pixelformat;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
 
 	return 0;
 }
 
+/*
+ * The visible rectangle in the output pictures. The rotator mirrors
+ * first and then rotates counter-clockwise, the rectangle moves along.
+ */
+static void vpu_dec_visible_rect(struct vpu_instance *instance,
+		struct v4l2_rect *r)
+{
+	int w = instance->width, h = instance->height;
+	struct v4l2_rect c = instance->crop;
+
+	if (instance->rotmir & 0x4)
+		c.top = h - c.top - c.height;
+	if (instance->rotmir & 0x8)
+		c.left = w - c.left - c.width;
+
+	switch (instance->rotmir & 0x3) {
+	case 0:
+		*r = c;
+		break;
+	case 1:
+		r->left = c.top;
+		r->top = w - c.left - c.width;
+		r->width = c.height;
+		r->height = c.width;
+		break;
+	case 2:
+		r->left = w - c.left - c.width;
+		r->top = h - c.top - c.height;
+		r->width = c.width;
+		r->height = c.height;
+		break;
+	case 3:
+		r->left = h - c.top - c.height;
+		r->top = c.left;
+		r->width = c.height;
+		r->height = c.width;
+		break;
+	}
+
+	/* narrowed down to the window of interest */
+	if (instance->roi.width && instance->roi.height) {
+		int x1 = max(r->left, instance->roi.left);
+		int y1 = max(r->top, instance->roi.top);
+		int x2 = min(r->left + (int)r->width,
+				instance->roi.left + (int)instance->roi.width);
+		int y2 = min(r->top + (int)r->height,
+				instance->roi.top + (int)instance->roi.height);
+
+		if (x2 > x1 && y2 > y1) {
+			r->left = x1;
+			r->top = y1;
+			r->width = x2 - x1;
+			r->height = y2 - y1;
+		}
+	}
+}
+
+/*
+ * The rotator can't offset its source, so the window of interest is
+ * reported as the visible part of the pictures. Downstream hardware only
+ * reads the window from the capture buffers. An empty rectangle resets
+ * the window.
+ */
+static int vpu_dec_set_roi(struct vpu_instance *instance,
+		const struct v4l2_rect *r)
+{
+	if (instance->mode != VPU_MODE_DECODER)
+		return -EINVAL;
+	if (r->left < 0 || r->top < 0 ||
+			r->width > 0xffff || r->height > 0xffff)
+		return -EINVAL;
+
+	instance->roi = *r;
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 8, 0)
+static int vpu_s_crop(struct file *file, void *priv,
+		const struct v4l2_crop *crop)
+#else
+static int vpu_s_crop(struct file *file, void *priv, struct v4l2_crop *crop)
+#endif
+{
+	struct vpu_instance *instance = file->private_data;
+
+	if (crop->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+
+	return vpu_dec_set_roi(instance, &crop->c);
+}
+
+static int vpu_g_crop(struct file *file, void *priv, struct v4l2_crop *crop)
+{
+	struct vpu_instance *instance = file->private_data;
+
+	if (crop->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+	if (instance->mode != VPU_MODE_DECODER)
+		return -EINVAL;
+	if (!instance->width)
+		return -EAGAIN;
+
+	vpu_dec_visible_rect(instance, &crop->c);
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 6, 0)
+static int vpu_g_selection(struct file *file, void *priv,
+		struct v4l2_selection *sel)
+{
+	struct vpu_instance *instance = file->private_data;
+
+	if (sel->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+	if (instance->mode != VPU_MODE_DECODER)
+		return -EINVAL;
+	if (!instance->width)
+		return -EAGAIN;
+
+	switch (sel->target) {
+	case V4L2_SEL_TGT_COMPOSE:
+	case V4L2_SEL_TGT_COMPOSE_DEFAULT:
+	case V4L2_SEL_TGT_CROP:
+	case V4L2_SEL_TGT_CROP_DEFAULT:
+		vpu_dec_visible_rect(instance, &sel->r);
+		break;
+	case V4L2_SEL_TGT_COMPOSE_BOUNDS:
+	case V4L2_SEL_TGT_COMPOSE_PADDED:
+	case V4L2_SEL_TGT_CROP_BOUNDS:
+		sel->r.left = 0;
+		sel->r.top = 0;
+		if (instance->rotmir & 0x1) {
+			sel->r.width = instance->height;
+			sel->r.height = instance->width;
+		} else {
+			sel->r.width = instance->width;
+			sel->r.height = instance->height;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int vpu_s_selection(struct file *file, void *priv,
+		struct v4l2_selection *sel)
+{
+	struct vpu_instance *instance = file->private_data;
+	int ret;
+
+	if (sel->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+	if (sel->target != V4L2_SEL_TGT_CROP)
+		return -EINVAL;
+
+	ret = vpu_dec_set_roi(instance, &sel->r);
+	if (ret || !instance->width)
+		return ret;
+
+	/* report the rectangle actually used */
+	vpu_dec_visible_rect(instance, &sel->r);
+
+	return 0;
+}
+#endif
+
+static const u32 vpu_dec_pixelformats[] = {
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_YUV422P,
+};
+
+static int vpu_enum_fmt_vid_cap(struct file *file, void *priv,
+				struct v4l2_fmtdesc *f)
+{
+	if (f->index >= ARRAY_SIZE(vpu_dec_pixelformats))
+		return -EINVAL;
+
+	f->pixelformat = vpu_dec_pixelformats[f->index];
+
+	return 0;
+}
+
+/* the decoder falls back to planar 4:2:0 for unsupported formats */
+static u32 vpu_dec_pixelformat(struct vpu_instance *instance, u32 pixelformat)
+{
+	int i;
+
+	/* only JPEG pictures can be decoded with 4:2:2 chroma */
+	if (pixelformat == V4L2_PIX_FMT_YUV422P &&
+			instance->standard != STD_MJPG)
+		return V4L2_PIX_FMT_YUV420;
+
+	for (i = 0; i < ARRAY_SIZE(vpu_dec_pixelformats); i++)
+		if (pixelformat == vpu_dec_pixelformats[i])
+			return pixelformat;
+
+	return V4L2_PIX_FMT_YUV420;
+}
+
+static int vpu_try_fmt_vid_cap(struct file *file, void *priv,
+				struct v4l2_format *fmt)
+{
+	struct vpu_instance *instance = file->private_data;
+	u32 pixelformat = vpu_dec_pixelformat(instance, fmt->fmt.pix.pixelformat);
+
+	/* the picture size is given by the stream */
+	if (instance->width)
+		vpu_g_fmt_vid_cap(file, priv, fmt);
+	fmt->fmt.pix.pixelformat = pixelformat;
+
+	return 0;
+}
+
+static int vpu_s_fmt_vid_cap(struct file *file, void *priv,
+				struct v4l2_format *fmt)
+{
+	struct vpu_instance *instance = file->private_data;
+
+	if (instance->vidq.streaming)
+		return -EBUSY;
+
+	instance->pixelformat = vpu_dec_pixelformat(instance,
+			fmt->fmt.pix.pixelformat);
+
+	return vpu_try_fmt_vid_cap(file, priv, fmt);
+}
+
 static int vpu_g_fmt_vid_out(struct file *file, void *priv,
 				struct v4l2_format *fmt)
 {
@@ -2030,10 +3187,18 @@ static unsigned int vpu_poll(struct file *file, struct poll_table_struct *wait)
 
 	if (instance->mode == VPU_MODE_DECODER) {
 		poll_wait(file, &instance->waitq, wait);
-		if (vpu_fifo_avail(instance) > 0)
+		/* chunked pictures also need a slot for VPU_IOC_PIC_END */
+		if (vpu_fifo_avail(instance) > 0 &&
+				(!vpu_dec_chunked(instance->standard) ||
+				 instance->au_in - instance->au_out < VPU_MAX_AU))
 			ret |= POLLOUT | POLLWRNORM;
 
-		if (instance->vidq.streaming)
+		/*
+		 * A decoder sharing a canvas has no capture buffer queued
+		 * while it waits for the swap, vb2 reports that as an error.
+		 */
+		if (instance->vidq.streaming &&
+				!list_empty(&instance->vidq.queued_list))
 			ret |= vb2_poll(&instance->vidq, file, wait);
 	} else {
 		if (instance->vidq.streaming)
@@ -2044,15 +3209,27 @@ static unsigned int vpu_poll(struct file *file, struct poll_table_struct *wait)
 }
 
 static const struct v4l2_ioctl_ops vpu_ioctl_ops = {
+	.vidioc_enum_fmt_vid_cap     = vpu_enum_fmt_vid_cap,
 	.vidioc_g_fmt_vid_cap 	     = vpu_g_fmt_vid_cap,
+	.vidioc_try_fmt_vid_cap      = vpu_try_fmt_vid_cap,
+	.vidioc_s_fmt_vid_cap        = vpu_s_fmt_vid_cap,
 	.vidioc_g_fmt_vid_out	     = vpu_g_fmt_vid_out,
 	.vidioc_s_fmt_vid_out        = vpu_s_fmt_vid_out,
 	.vidioc_reqbufs              = vpu_reqbufs,
 	.vidioc_querybuf             = vpu_querybuf,
 	.vidioc_qbuf                 = vpu_qbuf,
 	.vidioc_dqbuf                = vpu_dqbuf,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 8, 0)
+	.vidioc_expbuf               = vpu_expbuf,
+#endif
 	.vidioc_streamon             = vpu_streamon,
 	.vidioc_streamoff            = vpu_streamoff,
+	.vidioc_g_crop               = vpu_g_crop,
+	.vidioc_s_crop               = vpu_s_crop,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 6, 0)
+	.vidioc_g_selection          = vpu_g_selection,
+	.vidioc_s_selection          = vpu_s_selection,
+#endif
 };
 
 static const struct v4l2_file_operations vpu_fops = {
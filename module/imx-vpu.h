@@ -43,6 +43,7 @@
 #define BIT_PARA_BUF_ADDR		0x108
 #define BIT_BIT_STREAM_CTRL		0x10C
 #define BIT_FRAME_MEM_CTRL		0x110
+#define FRAME_MEM_CTRL_CBCR_INTERLEAVE	(1 << 2)
 #define CMD_DEC_DISPLAY_REORDER		0x114
 #define BIT_BIT_STREAM_PARAM		0x114
 #define BIT_VPU_PIC_COUNT		0x118
@@ -82,11 +83,13 @@
 #define CMD_DEC_SEQ_BB_START		0x180
 #define CMD_DEC_SEQ_BB_SIZE		0x184
 #define CMD_DEC_SEQ_OPTION		0x188
+#define DEC_SEQ_OPT_REORDER_EN		(1 << 1)
 #define CMD_DEC_SEQ_SRC_SIZE		0x18C
 #define CMD_DEC_SEQ_START_BYTE		0x190
 #define CMD_DEC_SEQ_PS_BB_START		0x194
 #define CMD_DEC_SEQ_PS_BB_SIZE		0x198
 #define CMD_DEC_SEQ_MP4_ASP_CLASS       0x19C
+#define CMD_DEC_SEQ_JPG_THUMB_EN	0x19C
 
 #define CMD_DEC_SEQ_INIT_ESCAPE		0x114
 
@@ -164,10 +167,17 @@
 #define CMD_DEC_PIC_BB_START		0x1A0
 #define CMD_DEC_PIC_START_BYTE		0x1A4
 
+#define DEC_PIC_OPT_PRESCAN_EN		(1 << 0)
+#define DEC_PIC_OPT_PRESCAN_MODE	(1 << 1)
+#define DEC_PIC_OPT_IFRAME_SEARCH	(1 << 2)
+#define DEC_PIC_OPT_SKIP_NON_I		(1 << 3)
+#define DEC_PIC_OPT_SKIP_NON_REF	(2 << 3)
+
 #define RET_DEC_PIC_FRAME_NUM		0x1C0
 #define RET_DEC_PIC_FRAME_IDX		0x1C4
 #define RET_DEC_PIC_ERR_MB		0x1C8
 #define RET_DEC_PIC_TYPE		0x1CC
+#define RET_DEC_PIC_CUR_IDX		0x1DC
 
 #define RET_DEC_PIC_POST		0x1D0
 
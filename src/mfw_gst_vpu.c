@@ -32,6 +32,10 @@ mfw_gst_vpu_codec_get_type(void)
 		{STD_H263, "1", "std_h263"},
 		{STD_AVC, "2", "std_avc"},
 		{STD_MJPG, "3", "std_mjpg"},
+		{STD_MPEG2, "4", "std_mpeg2"},
+		{STD_VC1, "5", "std_vc1"},
+		{STD_DIV3, "6", "std_div3"},
+		{STD_RV, "7", "std_rv"},
 		{0, NULL, NULL},
 	};
 	if (!vpu_codec_type) {
@@ -22,6 +22,22 @@ enum {
 	MFW_GST_VPU_ROTATION,
 	MFW_GST_VPU_MIRROR,
 	MFW_GST_VPUENC_MJPEG_QUALITY,
+	MFW_GST_VPU_PUSH_LIST,
+	MFW_GST_VPU_CAPTURE_BUFFERS,
+	MFW_GST_VPU_POOL_HITS,
+	MFW_GST_VPU_POOL_MISSES,
+	MFW_GST_VPU_KEYFRAME_ONLY,
+	MFW_GST_VPU_LOW_LATENCY,
+	MFW_GST_VPU_FB_DEVICE,
+	MFW_GST_VPU_EXPORT_DMABUF,
+	MFW_GST_VPU_OUTPUT_INTERVAL,
+	MFW_GST_VPU_CROP_WINDOW,
+	MFW_GST_VPU_CANVAS,
+	MFW_GST_VPU_CANVAS_SIZE,
+	MFW_GST_VPU_CANVAS_TILE,
+	MFW_GST_VPU_FRAME_CACHE_SIZE,
+	MFW_GST_VPU_INPUT_QUEUE_HIGH,
+	MFW_GST_VPU_INPUT_QUEUE_LOW,
 };
 
 #endif /* __MFW_GST_VPU_H */
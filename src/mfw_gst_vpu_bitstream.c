@@ -0,0 +1,839 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Module Name:    mfw_gst_vpu_bitstream.c
+ *
+ * Description:    Start code scanning and access unit detection for the
+ *                 VPU decoder
+ *
+ * Portability:    This code is written for Linux OS and Gstreamer
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "mfw_gst_utils.h"
+#include "mfw_gst_vpu_bitstream.h"
+
+#define BLOCK_SIZE	16
+
+/* H.264 NAL unit types */
+#define NAL_SLICE		1
+#define NAL_SLICE_IDR		5
+#define NAL_SEI			6
+#define NAL_SPS			7
+#define NAL_PPS			8
+#define NAL_AUD			9
+#define NAL_PREFIX_FIRST	14
+#define NAL_PREFIX_LAST		18
+
+/* MPEG-4 part 2 start codes */
+#define MP4_VOL_FIRST		0x20
+#define MP4_VOL_LAST		0x2f
+#define MP4_VOS			0xb0
+#define MP4_GOV			0xb3
+#define MP4_VO			0xb5
+#define MP4_VOP			0xb6
+
+/* JPEG markers */
+#define JPEG_SOF0		0xc0
+#define JPEG_SOF1		0xc1
+#define JPEG_SOF2		0xc2
+#define JPEG_DHT		0xc4
+#define JPEG_RST0		0xd0
+#define JPEG_SOI		0xd8
+#define JPEG_EOI		0xd9
+#define JPEG_SOS		0xda
+#define JPEG_TEM		0x01
+
+/*
+ * A start code begins with two zero bytes, so blocks without any zero
+ * byte can be skipped. This is where the scanner spends its time.
+ */
+static inline gboolean block_has_zero(const guint8 *p)
+{
+#if defined(__ARM_NEON__)
+	uint8x16_t z = vceqq_u8(vld1q_u8(p), vdupq_n_u8(0));
+	uint64x2_t z64 = vreinterpretq_u64_u8(z);
+
+	return (vgetq_lane_u64(z64, 0) | vgetq_lane_u64(z64, 1)) != 0;
+#elif defined(__SSE2__)
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0;
+#else
+	return memchr(p, 0, BLOCK_SIZE) != NULL;
+#endif
+}
+
+gint mfw_gst_vpu_find_start_code(const guint8 *data, guint size)
+{
+	guint i = 0, end;
+
+	while (i + 2 < size) {
+		if (i + BLOCK_SIZE <= size && !block_has_zero(data + i)) {
+			i += BLOCK_SIZE;
+			continue;
+		}
+
+		end = MIN(i + BLOCK_SIZE, size - 2);
+		for (; i < end; i++) {
+			if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+				return i;
+		}
+	}
+
+	return -1;
+}
+
+gboolean mfw_gst_vpu_au_supported(gint codec)
+{
+	return codec == STD_AVC || codec == STD_MPEG4;
+}
+
+static gboolean h264_starts_au(const guint8 *hdr, gboolean *has_picture)
+{
+	guint type = hdr[0] & 0x1f;
+
+	switch (type) {
+	case NAL_SLICE:
+	case NAL_SLICE_IDR:
+		/* first_mb_in_slice == 0 is coded as a single 1 bit */
+		if (*has_picture && (hdr[1] & 0x80))
+			return TRUE;
+		*has_picture = TRUE;
+		return FALSE;
+	case NAL_SEI:
+	case NAL_SPS:
+	case NAL_PPS:
+	case NAL_AUD:
+		return *has_picture;
+	default:
+		if (type >= NAL_PREFIX_FIRST && type <= NAL_PREFIX_LAST)
+			return *has_picture;
+		return FALSE;
+	}
+}
+
+static gboolean mpeg4_starts_au(const guint8 *hdr, gboolean *has_picture)
+{
+	guint code = hdr[0];
+
+	if (code == MP4_VOP) {
+		if (*has_picture)
+			return TRUE;
+		*has_picture = TRUE;
+		return FALSE;
+	}
+
+	/* headers belong to the picture following them */
+	if (code <= MP4_VOL_LAST || code == MP4_VOS || code == MP4_GOV ||
+			code == MP4_VO)
+		return *has_picture;
+
+	return FALSE;
+}
+
+gboolean mfw_gst_vpu_starts_au(gint codec, const guint8 *hdr,
+		gboolean *has_picture)
+{
+	switch (codec) {
+	case STD_AVC:
+		return h264_starts_au(hdr, has_picture);
+	case STD_MPEG4:
+		return mpeg4_starts_au(hdr, has_picture);
+	default:
+		return FALSE;
+	}
+}
+
+/*
+ * Minimal bit reader for sequence headers. Emulation prevention bytes are
+ * skipped, running out of data reads zeros and sets the error flag.
+ */
+typedef struct {
+	const guint8 *data;
+	guint size;
+	guint pos;	/* byte position */
+	guint bit;	/* bits used of the current byte */
+	guint zeros;	/* consecutive zero bytes before pos */
+	gboolean epb;	/* skip emulation prevention bytes */
+	gboolean error;
+} BitReader;
+
+static guint br_read_bit(BitReader *br)
+{
+	guint val;
+
+	if (br->bit == 0 && br->epb && br->zeros >= 2 &&
+			br->pos < br->size && br->data[br->pos] == 3) {
+		br->pos++;
+		br->zeros = 0;
+	}
+
+	if (br->pos >= br->size) {
+		br->error = TRUE;
+		return 0;
+	}
+
+	val = (br->data[br->pos] >> (7 - br->bit)) & 1;
+
+	if (++br->bit == 8) {
+		br->zeros = br->data[br->pos] ? 0 : br->zeros + 1;
+		br->bit = 0;
+		br->pos++;
+	}
+
+	return val;
+}
+
+static guint br_read(BitReader *br, guint n)
+{
+	guint val = 0;
+
+	while (n--)
+		val = (val << 1) | br_read_bit(br);
+
+	return val;
+}
+
+static guint br_read_ue(BitReader *br)
+{
+	guint zeros = 0;
+
+	while (!br_read_bit(br) && !br->error && zeros < 32)
+		zeros++;
+
+	return (1 << zeros) - 1 + br_read(br, zeros);
+}
+
+static gint br_read_se(BitReader *br)
+{
+	guint val = br_read_ue(br);
+
+	return val & 1 ? (val + 1) / 2 : -(gint)(val / 2);
+}
+
+static void h264_skip_scaling_list(BitReader *br, guint size)
+{
+	gint last = 8, next = 8;
+	guint i;
+
+	for (i = 0; i < size && !br->error; i++) {
+		if (next)
+			next = (last + br_read_se(br) + 256) % 256;
+		if (next)
+			last = next;
+	}
+}
+
+static void h264_skip_hrd(BitReader *br)
+{
+	guint i, n;
+
+	n = br_read_ue(br) + 1;	/* cpb_cnt_minus1 */
+	br_read(br, 8);		/* bit_rate_scale, cpb_size_scale */
+	for (i = 0; i < n && !br->error; i++) {
+		br_read_ue(br);	/* bit_rate_value_minus1 */
+		br_read_ue(br);	/* cpb_size_value_minus1 */
+		br_read_bit(br);	/* cbr_flag */
+	}
+	br_read(br, 20);	/* delay and time offset lengths */
+}
+
+/*
+ * Tells from the VUI whether pictures are output in decoding order. Only
+ * the bitstream restriction says so explicitly.
+ */
+static gboolean h264_vui_low_delay(BitReader *br)
+{
+	gboolean nal_hrd, vcl_hrd;
+
+	if (br_read_bit(br) && br_read(br, 8) == 255)	/* aspect_ratio_idc */
+		br_read(br, 32);	/* sar_width, sar_height */
+	if (br_read_bit(br))	/* overscan_info_present */
+		br_read_bit(br);
+	if (br_read_bit(br)) {	/* video_signal_type_present */
+		br_read(br, 4);
+		if (br_read_bit(br))	/* colour_description_present */
+			br_read(br, 24);
+	}
+	if (br_read_bit(br)) {	/* chroma_loc_info_present */
+		br_read_ue(br);
+		br_read_ue(br);
+	}
+	if (br_read_bit(br)) {	/* timing_info_present */
+		br_read(br, 32);
+		br_read(br, 32);
+		br_read_bit(br);
+	}
+	nal_hrd = br_read_bit(br);
+	if (nal_hrd)
+		h264_skip_hrd(br);
+	vcl_hrd = br_read_bit(br);
+	if (vcl_hrd)
+		h264_skip_hrd(br);
+	if (nal_hrd || vcl_hrd)
+		br_read_bit(br);	/* low_delay_hrd */
+	br_read_bit(br);	/* pic_struct_present */
+
+	if (!br_read_bit(br))	/* bitstream_restriction */
+		return FALSE;
+	br_read_bit(br);	/* motion_vectors_over_pic_boundaries */
+	br_read_ue(br);		/* max_bytes_per_pic_denom */
+	br_read_ue(br);		/* max_bits_per_mb_denom */
+	br_read_ue(br);		/* log2_max_mv_length_horizontal */
+	br_read_ue(br);		/* log2_max_mv_length_vertical */
+
+	return br_read_ue(br) == 0 && !br->error;	/* max_num_reorder_frames */
+}
+
+/* data points to the NAL unit header */
+static gboolean h264_parse_sps(const guint8 *data, guint size,
+		MfwGstVpuSeqInfo *info)
+{
+	BitReader br = { data + 1, size - 1, 0, 0, 0, TRUE, FALSE };
+	guint profile, chroma_format = 1, poc_type, mbs_w, map_h, frame_mbs_only;
+	guint i, n, num_ref_frames, crop[4] = { 0, 0, 0, 0 };
+
+	profile = br_read(&br, 8);
+	br_read(&br, 16);	/* constraint flags, level */
+	br_read_ue(&br);	/* seq_parameter_set_id */
+
+	switch (profile) {
+	case 100: case 110: case 122: case 244: case 44:
+	case 83: case 86: case 118: case 128:
+		chroma_format = br_read_ue(&br);
+		if (chroma_format == 3)
+			br_read_bit(&br);	/* separate_colour_plane */
+		br_read_ue(&br);	/* bit_depth_luma */
+		br_read_ue(&br);	/* bit_depth_chroma */
+		br_read_bit(&br);	/* qpprime_y_zero_transform_bypass */
+		if (br_read_bit(&br)) {
+			n = chroma_format == 3 ? 12 : 8;
+			for (i = 0; i < n; i++)
+				if (br_read_bit(&br))
+					h264_skip_scaling_list(&br, i < 6 ? 16 : 64);
+		}
+		break;
+	}
+
+	br_read_ue(&br);	/* log2_max_frame_num */
+	poc_type = br_read_ue(&br);
+	if (poc_type == 0) {
+		br_read_ue(&br);	/* log2_max_pic_order_cnt_lsb */
+	} else if (poc_type == 1) {
+		br_read_bit(&br);
+		br_read_se(&br);
+		br_read_se(&br);
+		n = br_read_ue(&br);
+		for (i = 0; i < n && !br.error; i++)
+			br_read_se(&br);
+	}
+	num_ref_frames = br_read_ue(&br);
+	br_read_bit(&br);	/* gaps_in_frame_num_allowed */
+	mbs_w = br_read_ue(&br) + 1;
+	map_h = br_read_ue(&br) + 1;
+	frame_mbs_only = br_read_bit(&br);
+	if (!frame_mbs_only)
+		br_read_bit(&br);	/* mb_adaptive_frame_field */
+	br_read_bit(&br);	/* direct_8x8_inference */
+	if (br_read_bit(&br)) {	/* frame_cropping */
+		for (i = 0; i < 4; i++)
+			crop[i] = br_read_ue(&br);
+	}
+
+	if (br.error)
+		return FALSE;
+
+	info->width = mbs_w * 16;
+	info->height = (2 - frame_mbs_only) * map_h * 16;
+	info->num_ref_frames = num_ref_frames;
+
+	/* in units of chroma samples, and of field lines for interlaced */
+	info->crop_left = crop[0] * 2;
+	info->crop_right = crop[1] * 2;
+	info->crop_top = crop[2] * 2 * (2 - frame_mbs_only);
+	info->crop_bottom = crop[3] * 2 * (2 - frame_mbs_only);
+	if (info->crop_left + info->crop_right >= info->width ||
+			info->crop_top + info->crop_bottom >= info->height)
+		info->crop_left = info->crop_right =
+			info->crop_top = info->crop_bottom = 0;
+
+	/* baseline has no B slices */
+	info->low_delay = profile == 66;
+	if (!info->low_delay && br_read_bit(&br))	/* vui_parameters_present */
+		info->low_delay = h264_vui_low_delay(&br);
+
+	return TRUE;
+}
+
+/* data points to the VOL start code value */
+static gboolean mpeg4_parse_vol(const guint8 *data, guint size,
+		MfwGstVpuSeqInfo *info)
+{
+	BitReader br = { data + 1, size - 1, 0, 0, 0, FALSE, FALSE };
+	guint verid = 1, shape, resolution, bits, type;
+
+	br_read_bit(&br);	/* random_accessible_vol */
+	type = br_read(&br, 8);	/* video_object_type_indication */
+	if (br_read_bit(&br)) {	/* is_object_layer_identifier */
+		verid = br_read(&br, 4);
+		br_read(&br, 3);	/* priority */
+	}
+	if (br_read(&br, 4) == 0xf)	/* aspect_ratio_info */
+		br_read(&br, 16);	/* par_width, par_height */
+	/* without control parameters only simple objects have no B-VOPs */
+	info->low_delay = type == 1;
+	if (br_read_bit(&br)) {	/* vol_control_parameters */
+		br_read(&br, 2);	/* chroma_format */
+		info->low_delay = br_read_bit(&br);
+		if (br_read_bit(&br)) {	/* vbv_parameters */
+			br_read(&br, 16);	/* bit_rate */
+			br_read(&br, 16);
+			br_read(&br, 16);	/* vbv_buffer_size */
+			br_read(&br, 3);
+			br_read(&br, 12);	/* vbv_occupancy */
+			br_read(&br, 16);
+		}
+	}
+	shape = br_read(&br, 2);
+	if (shape == 3 && verid != 1)
+		br_read(&br, 4);	/* video_object_layer_shape_extension */
+	br_read_bit(&br);	/* marker */
+	resolution = br_read(&br, 16);
+	br_read_bit(&br);	/* marker */
+	if (br_read_bit(&br)) {	/* fixed_vop_rate */
+		for (bits = 1; (1U << bits) < resolution; bits++)
+			;
+		br_read(&br, bits);
+	}
+
+	/* only rectangular shapes carry a size */
+	if (shape != 0 || br.error)
+		return FALSE;
+
+	br_read_bit(&br);
+	info->width = br_read(&br, 13);
+	br_read_bit(&br);
+	info->height = br_read(&br, 13);
+
+	if (br.error || !info->width || !info->height)
+		return FALSE;
+
+	/* a P-VOP refers to one picture, a B-VOP to two */
+	info->num_ref_frames = info->low_delay ? 1 : 2;
+	info->crop_left = info->crop_top = 0;
+	info->crop_right = ((info->width + 15) & ~15) - info->width;
+	info->crop_bottom = ((info->height + 15) & ~15) - info->height;
+
+	info->width = (info->width + 15) & ~15;
+	info->height = (info->height + 15) & ~15;
+
+	return TRUE;
+}
+
+/*
+ * H.263 has no sequence header, the source format is in every picture
+ * header. The first byte aligned picture start code in data is used,
+ * pictures only carry a custom format when UFEP signals OPPTYPE.
+ */
+static gboolean h263_parse_picture(const guint8 *data, guint size,
+		MfwGstVpuSeqInfo *info)
+{
+	static const gint formats[6][2] = {
+		{ 0, 0 }, { 128, 96 }, { 176, 144 }, { 352, 288 },
+		{ 704, 576 }, { 1408, 1152 },
+	};
+	BitReader br = { NULL, 0, 0, 0, 0, FALSE, FALSE };
+	guint pos, format;
+
+	for (pos = 0; pos + 8 <= size; pos++)
+		if (!data[pos] && !data[pos + 1] &&
+				(data[pos + 2] & 0xfc) == 0x80)
+			break;
+	if (pos + 8 > size)
+		return FALSE;
+
+	br.data = data + pos + 2;
+	br.size = size - pos - 2;
+	br_read(&br, 6);	/* rest of the PSC */
+	br_read(&br, 8);	/* TR */
+	br_read(&br, 5);	/* PTYPE up to the source format */
+	format = br_read(&br, 3);
+	info->width = info->height = 0;
+
+	if (format == 7) {	/* PLUSPTYPE */
+		if (br_read(&br, 3) != 1)	/* UFEP */
+			return FALSE;
+		format = br_read(&br, 3);
+		if (format == 6) {
+			br_read(&br, 15);	/* rest of OPPTYPE */
+			br_read(&br, 9);	/* MPPTYPE */
+			if (br_read_bit(&br))	/* CPM */
+				br_read(&br, 2);	/* PSBI */
+			br_read(&br, 4);	/* PAR */
+			info->width = (br_read(&br, 9) + 1) * 4;
+			br_read_bit(&br);
+			info->height = br_read(&br, 9) * 4;
+		}
+	}
+	if (format >= 1 && format <= 5) {
+		info->width = formats[format][0];
+		info->height = formats[format][1];
+	}
+
+	if (br.error || !info->width || !info->height)
+		return FALSE;
+
+	/* Annex O allows B pictures */
+	info->low_delay = FALSE;
+	info->num_ref_frames = 2;
+	info->crop_left = info->crop_top = 0;
+	info->crop_right = ((info->width + 15) & ~15) - info->width;
+	info->crop_bottom = ((info->height + 15) & ~15) - info->height;
+
+	info->width = (info->width + 15) & ~15;
+	info->height = (info->height + 15) & ~15;
+
+	return TRUE;
+}
+
+gboolean mfw_gst_vpu_find_seq_info(gint codec, const guint8 *data,
+		guint size, MfwGstVpuSeqInfo *info)
+{
+	guint pos = 0, code;
+	gint ofs;
+
+	if (codec == STD_H263)
+		return h263_parse_picture(data, size, info);
+
+	while (pos + 4 < size) {
+		ofs = mfw_gst_vpu_find_start_code(data + pos, size - pos);
+		if (ofs < 0)
+			break;
+		pos += ofs + 3;
+		if (pos + 1 >= size)
+			break;
+
+		switch (codec) {
+		case STD_AVC:
+			code = data[pos] & 0x1f;
+			if (code == NAL_SPS)
+				return h264_parse_sps(data + pos, size - pos,
+						info);
+			if (code == NAL_SLICE || code == NAL_SLICE_IDR)
+				return FALSE;
+			break;
+		case STD_MPEG4:
+			code = data[pos];
+			if (code >= MP4_VOL_FIRST && code <= MP4_VOL_LAST)
+				return mpeg4_parse_vol(data + pos, size - pos,
+						info);
+			if (code == MP4_VOP)
+				return FALSE;
+			break;
+		default:
+			return FALSE;
+		}
+	}
+
+	return FALSE;
+}
+
+GstBuffer *mfw_gst_vpu_avcc_to_annexb(const guint8 *data, guint size,
+		guint *nal_length_size)
+{
+	static const guint8 start_code[4] = { 0, 0, 0, 1 };
+	GstBuffer *buf = NULL;
+	guint8 *out = NULL;
+	guint ofs, len, outsize = 0, i, num, count;
+
+	/* configurationVersion, profile, compat, level, lengthSizeMinusOne */
+	if (size < 7 || data[0] != 1)
+		return NULL;
+
+	/* two passes, the first one computes the output size */
+	for (i = 0; i < 2; i++) {
+		if (i) {
+			buf = gst_buffer_new_and_alloc(outsize);
+			out = GST_BUFFER_DATA(buf);
+		}
+
+		ofs = 5;
+		/* SPS first, then PPS */
+		for (count = 0; count < 2; count++) {
+			if (ofs >= size)
+				goto invalid;
+			num = count ? data[ofs] : data[ofs] & 0x1f;
+			ofs++;
+
+			while (num--) {
+				if (ofs + 2 > size)
+					goto invalid;
+				len = GST_READ_UINT16_BE(data + ofs);
+				ofs += 2;
+				if (ofs + len > size)
+					goto invalid;
+
+				if (i) {
+					memcpy(out, start_code, sizeof(start_code));
+					memcpy(out + sizeof(start_code), data + ofs, len);
+					out += sizeof(start_code) + len;
+				} else {
+					outsize += sizeof(start_code) + len;
+				}
+				ofs += len;
+			}
+		}
+	}
+
+	*nal_length_size = (data[4] & 0x3) + 1;
+
+	return buf;
+
+invalid:
+	if (i)
+		gst_buffer_unref(buf);
+	return NULL;
+}
+
+/*
+ * The standard Huffman tables of the JPEG specification (K.3) as DHT
+ * segment. Motion JPEG pictures usually come without them.
+ */
+const guint8 mfw_gst_vpu_jpeg_dht[MFW_GST_VPU_JPEG_DHT_SIZE] = {
+	0xff, 0xc4, 0x01, 0xa2, 0x00, 0x00, 0x01, 0x05,
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02,
+	0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+	0x0b, 0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02,
+	0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00,
+	0x01, 0x7d, 0x01, 0x02, 0x03, 0x00, 0x04, 0x11,
+	0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51,
+	0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91,
+	0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
+	0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09,
+	0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37,
+	0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47,
+	0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57,
+	0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67,
+	0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77,
+	0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+	0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+	0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
+	0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+	0xf7, 0xf8, 0xf9, 0xfa, 0x01, 0x00, 0x03, 0x01,
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02,
+	0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+	0x0b, 0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04,
+	0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01,
+	0x02, 0x77, 0x00, 0x01, 0x02, 0x03, 0x11, 0x04,
+	0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07,
+	0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14,
+	0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33,
+	0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16,
+	0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19,
+	0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36,
+	0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46,
+	0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56,
+	0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66,
+	0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76,
+	0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85,
+	0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
+	0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+	0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2,
+	0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+	0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+	0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+	0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+	0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+	0xf7, 0xf8, 0xf9, 0xfa,
+};
+
+gboolean mfw_gst_vpu_jpeg_parse(const guint8 *data, guint size,
+		gint *dht_ofs, gboolean *yuv422, gint *width, gint *height)
+{
+	gboolean has_dht = FALSE, has_sof = FALSE;
+	guint pos = 2, len, marker;
+
+	if (size < 4 || data[0] != 0xff || data[1] != JPEG_SOI)
+		return FALSE;
+
+	while (pos + 4 <= size) {
+		if (data[pos] != 0xff)
+			return FALSE;
+
+		marker = data[pos + 1];
+		if (marker == 0xff) {
+			/* fill byte */
+			pos++;
+			continue;
+		}
+
+		if (marker == JPEG_SOS) {
+			if (!has_sof)
+				return FALSE;
+			*dht_ofs = has_dht ? -1 : pos;
+			return TRUE;
+		}
+
+		/* markers without a segment */
+		if (marker == JPEG_TEM || marker == JPEG_SOI ||
+				(marker >= JPEG_RST0 && marker < JPEG_SOI)) {
+			pos += 2;
+			continue;
+		}
+		if (marker == JPEG_EOI)
+			return FALSE;
+
+		len = GST_READ_UINT16_BE(data + pos + 2);
+		if (len < 2 || pos + 2 + len > size)
+			return FALSE;
+
+		if (marker == JPEG_DHT) {
+			has_dht = TRUE;
+		} else if (marker == JPEG_SOF2) {
+			/* progressive pictures can't be decoded by the VPU */
+			return FALSE;
+		} else if (marker == JPEG_SOF0 || marker == JPEG_SOF1) {
+			/* P, Y, X, Nf, then C, H/V, Tq for each component */
+			if (len < 8 + 3 * 3 || data[pos + 9] != 3)
+				return FALSE;
+			/* frame buffers are 4:2:0 or horizontal 4:2:2 only */
+			if ((data[pos + 11] != 0x22 && data[pos + 11] != 0x21) ||
+					data[pos + 14] != 0x11 ||
+					data[pos + 17] != 0x11)
+				return FALSE;
+			*yuv422 = data[pos + 11] == 0x21;
+			*height = GST_READ_UINT16_BE(data + pos + 5);
+			*width = GST_READ_UINT16_BE(data + pos + 7);
+			if (!*width || !*height)
+				return FALSE;
+			has_sof = TRUE;
+		}
+
+		pos += 2 + len;
+	}
+
+	return FALSE;
+}
+
+GstBuffer *mfw_gst_vpu_vc1_rcv_header(const guint8 *struct_c, guint size,
+		gint width, gint height, gint fps)
+{
+	GstBuffer *buf;
+	guint8 *out;
+
+	if (size < 4)
+		return NULL;
+
+	buf = gst_buffer_new_and_alloc(MFW_GST_VPU_RCV_SEQ_SIZE);
+	out = GST_BUFFER_DATA(buf);
+
+	/* RCV version 2, number of frames unknown */
+	GST_WRITE_UINT32_LE(out, 0xc5ffffff);
+	GST_WRITE_UINT32_LE(out + 4, 4);
+	memcpy(out + 8, struct_c, 4);
+	GST_WRITE_UINT32_LE(out + 12, height);
+	GST_WRITE_UINT32_LE(out + 16, width);
+	GST_WRITE_UINT32_LE(out + 20, 12);
+	/* STRUCT_B: level, cbr and HRD parameters are not signalled */
+	GST_WRITE_UINT32_LE(out + 24, 0);
+	GST_WRITE_UINT32_LE(out + 28, 0);
+	GST_WRITE_UINT32_LE(out + 32, fps);
+
+	return buf;
+}
+
+void mfw_gst_vpu_vc1_rcv_frame(guint8 *hdr, guint size, gboolean keyframe,
+		guint ms)
+{
+	GST_WRITE_UINT32_LE(hdr, size | (keyframe ? 0x80000000 : 0));
+	GST_WRITE_UINT32_LE(hdr + 4, ms);
+}
+
+GstBuffer *mfw_gst_vpu_rv_seq_header(gint version, gint width, gint height,
+		gint fps_n, gint fps_d, const guint8 *extra, guint extra_size)
+{
+	GstBuffer *buf;
+	guint8 *out;
+	guint size = 26 + extra_size;
+
+	buf = gst_buffer_new_and_alloc(size);
+	out = GST_BUFFER_DATA(buf);
+
+	/* the type specific data of a RealMedia video stream */
+	GST_WRITE_UINT32_BE(out, size);
+	memcpy(out + 4, "VIDO", 4);
+	memcpy(out + 8, version == 3 ? "RV30" : "RV40", 4);
+	GST_WRITE_UINT16_BE(out + 12, width);
+	GST_WRITE_UINT16_BE(out + 14, height);
+	GST_WRITE_UINT16_BE(out + 16, 12);
+	GST_WRITE_UINT32_BE(out + 18, 0);
+	GST_WRITE_UINT32_BE(out + 22, fps_d ?
+			(guint32)(((guint64)fps_n << 16) / fps_d) : 0);
+	if (extra_size)
+		memcpy(out + 26, extra, extra_size);
+
+	return buf;
+}
+
+guint mfw_gst_vpu_rv_frame(guint8 *hdr, const guint8 *data, guint size,
+		guint ms, guint seq, guint *data_ofs)
+{
+	guint num, i, ofs;
+
+	/* demuxed frames start with the slice count minus one ... */
+	if (size < 1)
+		return 0;
+	num = data[0] + 1;
+	ofs = 1 + 8 * num;
+	if (ofs > size)
+		return 0;
+
+	GST_WRITE_UINT32_BE(hdr, size - ofs);
+	GST_WRITE_UINT32_BE(hdr + 4, ms);
+	GST_WRITE_UINT16_BE(hdr + 8, seq);
+	GST_WRITE_UINT16_BE(hdr + 10, 0);
+	GST_WRITE_UINT32_BE(hdr + 12, 1);
+	GST_WRITE_UINT32_BE(hdr + 16, num);
+
+	/* ... and the little endian valid flag and offset of every slice */
+	for (i = 0; i < num; i++) {
+		GST_WRITE_UINT32_BE(hdr + 20 + 8 * i,
+				GST_READ_UINT32_LE(data + 1 + 8 * i));
+		GST_WRITE_UINT32_BE(hdr + 24 + 8 * i,
+				GST_READ_UINT32_LE(data + 5 + 8 * i));
+	}
+
+	*data_ofs = ofs;
+
+	return 20 + 8 * num;
+}
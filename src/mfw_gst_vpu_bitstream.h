@@ -0,0 +1,125 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Module Name:    mfw_gst_vpu_bitstream.h
+ *
+ * Description:    Start code scanning and access unit detection for the
+ *                 VPU decoder
+ *
+ * Portability:    This code is written for Linux OS and Gstreamer
+ */
+
+#ifndef __MFW_GST_VPU_BITSTREAM_H__
+#define __MFW_GST_VPU_BITSTREAM_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Returns the offset of the first 00 00 01 start code prefix in data or
+ * -1 if there is none.
+ */
+gint mfw_gst_vpu_find_start_code(const guint8 *data, guint size);
+
+/* TRUE if access units of the codec can be split by start codes */
+gboolean mfw_gst_vpu_au_supported(gint codec);
+
+/*
+ * Checks the unit following a start code. hdr points behind the start
+ * code prefix, at least two bytes must be available. Returns TRUE if the
+ * unit begins a new access unit. Otherwise *has_picture is updated to
+ * tell whether the current access unit contains a picture.
+ */
+gboolean mfw_gst_vpu_starts_au(gint codec, const guint8 *hdr,
+		gboolean *has_picture);
+
+typedef struct {
+	gint width;		/* coded picture size */
+	gint height;
+	gboolean low_delay;	/* pictures are coded in output order */
+	gint num_ref_frames;	/* reference pictures kept by the decoder */
+	gint crop_left;		/* borders of the coded picture not shown */
+	gint crop_right;
+	gint crop_top;
+	gint crop_bottom;
+} MfwGstVpuSeqInfo;
+
+/*
+ * Looks for a sequence header (H.264 SPS, MPEG-4 VOL) in front of the
+ * first picture in data and returns the stream properties from it. For
+ * H.263 they come from the first picture header.
+ */
+gboolean mfw_gst_vpu_find_seq_info(gint codec, const guint8 *data,
+		guint size, MfwGstVpuSeqInfo *info);
+
+/*
+ * Converts the SPS and PPS of an avcC decoder configuration record to
+ * start code prefixed NAL units. Returns NULL if the record is invalid,
+ * otherwise *nal_length_size is set to the size of the NAL unit length
+ * fields used in the stream.
+ */
+GstBuffer *mfw_gst_vpu_avcc_to_annexb(const guint8 *data, guint size,
+		guint *nal_length_size);
+
+#define MFW_GST_VPU_JPEG_DHT_SIZE	420
+
+extern const guint8 mfw_gst_vpu_jpeg_dht[MFW_GST_VPU_JPEG_DHT_SIZE];
+
+/*
+ * Walks the markers of a baseline JPEG picture up to the start of scan.
+ * *dht_ofs is set to where mfw_gst_vpu_jpeg_dht has to be inserted or -1
+ * if the picture has its own Huffman tables, *yuv422 to whether chroma
+ * is subsampled horizontally only and *width, *height to the picture
+ * size. Returns FALSE for invalid pictures and for any sampling other
+ * than three components with 4:2:0 or 4:2:2 chroma.
+ */
+gboolean mfw_gst_vpu_jpeg_parse(const guint8 *data, guint size,
+		gint *dht_ofs, gboolean *yuv422, gint *width, gint *height);
+
+#define MFW_GST_VPU_RCV_SEQ_SIZE	36
+#define MFW_GST_VPU_RCV_FRAME_SIZE	8
+
+/*
+ * Builds the RCV sequence layer the VPU needs for VC-1 simple and main
+ * profile streams from the STRUCT_C found in the codec data.
+ */
+GstBuffer *mfw_gst_vpu_vc1_rcv_header(const guint8 *struct_c, guint size,
+		gint width, gint height, gint fps);
+
+/* Fills the RCV frame layer in front of a picture of size bytes */
+void mfw_gst_vpu_vc1_rcv_frame(guint8 *hdr, guint size, gboolean keyframe,
+		guint ms);
+
+/* Builds the RealVideo sequence header from the caps of the stream */
+GstBuffer *mfw_gst_vpu_rv_seq_header(gint version, gint width, gint height,
+		gint fps_n, gint fps_d, const guint8 *extra, guint extra_size);
+
+#define MFW_GST_VPU_RV_FRAME_MAX	(20 + 8 * 256)
+
+/*
+ * Converts the slice table in front of a demuxed RealVideo frame to the
+ * frame header of the VPU. hdr must hold MFW_GST_VPU_RV_FRAME_MAX bytes.
+ * Returns the header size or 0 for invalid frames, *data_ofs is set to
+ * where the slice data begins.
+ */
+guint mfw_gst_vpu_rv_frame(guint8 *hdr, const guint8 *data, guint size,
+		guint ms, guint seq, guint *data_ofs);
+
+G_END_DECLS
+#endif				/* __MFW_GST_VPU_BITSTREAM_H__ */
@@ -0,0 +1,114 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Module Name:    mfw_gst_vpu_cache.c
+ *
+ * Description:    Memory bounded cache of decoded pictures
+ *
+ * Portability:    This code is written for Linux OS and Gstreamer
+ */
+
+#include <gst/gst.h>
+#include "mfw_gst_vpu_cache.h"
+
+void mfw_gst_vpu_cache_init(MfwGstVpuCache *cache, guint budget)
+{
+	g_queue_init(&cache->frames);
+	cache->size = 0;
+	cache->budget = budget;
+}
+
+guint mfw_gst_vpu_cache_add(MfwGstVpuCache *cache, GstBuffer *frame)
+{
+	GstBuffer *old;
+	guint dropped = 0;
+
+	g_queue_push_tail(&cache->frames, frame);
+	cache->size += GST_BUFFER_SIZE(frame);
+
+	/* a single frame over the budget isn't kept either */
+	while (cache->size > cache->budget) {
+		old = g_queue_pop_head(&cache->frames);
+		cache->size -= GST_BUFFER_SIZE(old);
+		gst_buffer_unref(old);
+		dropped++;
+	}
+
+	return dropped;
+}
+
+/*
+ * Frames are added in presentation order, a frame shows its timestamp
+ * up to the end of its duration or, without one, up to the next frame.
+ */
+GList *mfw_gst_vpu_cache_from(MfwGstVpuCache *cache, GstClockTime timestamp)
+{
+	GList *l, *frames = NULL;
+	GstClockTime next = GST_CLOCK_TIME_NONE, end;
+	GstBuffer *frame;
+
+	if (!GST_CLOCK_TIME_IS_VALID(timestamp))
+		return NULL;
+
+	for (l = cache->frames.tail; l; l = l->prev) {
+		frame = l->data;
+		frames = g_list_prepend(frames, gst_buffer_ref(frame));
+
+		if (!GST_BUFFER_TIMESTAMP_IS_VALID(frame) ||
+				GST_BUFFER_TIMESTAMP(frame) > timestamp) {
+			next = GST_BUFFER_TIMESTAMP(frame);
+			continue;
+		}
+
+		if (GST_BUFFER_DURATION_IS_VALID(frame))
+			end = GST_BUFFER_TIMESTAMP(frame) + GST_BUFFER_DURATION(frame);
+		else if (GST_CLOCK_TIME_IS_VALID(next))
+			end = next;
+		else
+			end = GST_BUFFER_TIMESTAMP(frame) + 1;
+
+		if (timestamp < end)
+			return frames;
+		break;
+	}
+
+	g_list_foreach(frames, (GFunc) gst_mini_object_unref, NULL);
+	g_list_free(frames);
+
+	return NULL;
+}
+
+GstBuffer *mfw_gst_vpu_cache_pop_newest(MfwGstVpuCache *cache)
+{
+	GstBuffer *frame;
+
+	frame = g_queue_pop_tail(&cache->frames);
+	if (frame)
+		cache->size -= GST_BUFFER_SIZE(frame);
+
+	return frame;
+}
+
+void mfw_gst_vpu_cache_clear(MfwGstVpuCache *cache)
+{
+	GstBuffer *frame;
+
+	while ((frame = g_queue_pop_head(&cache->frames)))
+		gst_buffer_unref(frame);
+	cache->size = 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Module Name:    mfw_gst_vpu_cache.h
+ *
+ * Description:    Memory bounded cache of decoded pictures
+ *
+ * Portability:    This code is written for Linux OS and Gstreamer
+ */
+
+#ifndef __MFW_GST_VPU_CACHE_H__
+#define __MFW_GST_VPU_CACHE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	GQueue frames;		/* oldest first */
+	guint size;		/* bytes held by the frames */
+	guint budget;		/* upper limit of size */
+} MfwGstVpuCache;
+
+void mfw_gst_vpu_cache_init(MfwGstVpuCache *cache, guint budget);
+
+/*
+ * Appends a frame, taking over the reference. The oldest frames are
+ * dropped to stay within the budget. Returns how many were dropped.
+ */
+guint mfw_gst_vpu_cache_add(MfwGstVpuCache *cache, GstBuffer *frame);
+
+/*
+ * Returns references to the frame showing timestamp and all frames added
+ * after it, oldest first, or NULL if that frame isn't cached.
+ */
+GList *mfw_gst_vpu_cache_from(MfwGstVpuCache *cache, GstClockTime timestamp);
+
+/* Removes the newest frame and returns its reference, NULL if empty */
+GstBuffer *mfw_gst_vpu_cache_pop_newest(MfwGstVpuCache *cache);
+
+void mfw_gst_vpu_cache_clear(MfwGstVpuCache *cache);
+
+G_END_DECLS
+#endif				/* __MFW_GST_VPU_CACHE_H__ */
@@ -26,6 +26,7 @@
  * Portability:    This code is written for Linux OS and Gstreamer
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -38,6 +39,9 @@
 #include <linux/videodev2.h>
 #include "mfw_gst_vpu.h"
 #include "mfw_gst_vpu_decoder.h"
+#include "mfw_gst_vpu_bitstream.h"
+#include "mfw_gst_vpu_fb.h"
+#include "mfw_gst_vpu_cache.h"
 
 #define MAX_WIDTH		4096
 #define MAX_HEIGHT		4096
@@ -46,23 +50,59 @@
     "video/mpeg, " \
     "width = (int) [16, 1920], " \
     "height = (int) [16, 1080], " \
-    "mpegversion = (int) 4; " \
+    "mpegversion = (int) { 1, 2, 4 }, " \
+    "systemstream = (boolean) false; " \
     \
     "video/x-divx, " \
     "width = (int) [16, 1920], " \
     "height = (int) [16, 1080], " \
-    "divxversion = (int) [4, 5]; " \
+    "divxversion = (int) [3, 5]; " \
+    \
+    "video/x-xvid, " \
+    "width = (int) [16, 1920], " \
+    "height = (int) [16, 1080]; " \
+    \
+    "video/x-wmv, " \
+    "width = (int) [16, 1920], " \
+    "height = (int) [16, 1080], " \
+    "wmvversion = (int) 3; " \
+    \
+    "video/x-pn-realvideo, " \
+    "width = (int) [16, 1920], " \
+    "height = (int) [16, 1080], " \
+    "rmversion = (int) [3, 4]; " \
     \
     "video/x-h263, " \
      "width = (int) [16, 1920], " \
-    "height = (int) [16, 1080], " \
+    "height = (int) [16, 1080]; " \
    \
     "video/x-h264, " \
     "width = (int) [16, 1920], " \
-    "height = (int)[16, 1080]"
+    "height = (int)[16, 1080], " \
+    "stream-format = (string) { byte-stream, avc }; " \
+    \
+    "image/jpeg, " \
+    "width = (int) [16, 1920], " \
+    "height = (int) [16, 1080]"
 
 #define DEFAULT_DBK_OFFSET_VALUE    5
 
+/* input timestamps remembered to look up the frame durations */
+#define MAX_TIMESTAMPS		32
+
+/* playback rates beyond which only intra pictures are decoded */
+#define KEYFRAME_ONLY_RATE	2.0
+
+/* canvas decoders look for a vacant owner this often without a frame rate */
+#define CANVAS_POLL_MS		40
+
+/* frame cache budget for reverse playback if frame-cache-size is 0 */
+#define REVERSE_CACHE_SIZE	(64 << 20)
+
+/* default watermarks of the input queue */
+#define INPUT_QUEUE_HIGH	(1 << 20)
+#define INPUT_QUEUE_LOW		(256 << 10)
+
 typedef struct _GstVPU_Dec {
 	/* Plug-in specific members */
 	GstElement element;	/* instance of base class */
@@ -80,6 +120,12 @@ typedef struct _GstVPU_Dec {
 	GstBuffer *hdr_ext_data;
 	guint hdr_ext_data_len;	/* Header Extension Data and length
 				   obtained through Caps Neogtiation */
+	gboolean avc;		/* H.264 NAL units with length prefixes */
+	gboolean jpeg_422;	/* JPEG pictures with 4:2:2 chroma */
+	gboolean vc1_rcv;	/* VC-1 simple/main, RCV frame layer */
+	gboolean vc1_ap;	/* VC-1 advanced, frame start codes */
+	guint rv_seq;		/* RealVideo frame counter */
+	guint nal_length_size;
 
 	/* Misc members */
 	guint64 decoded_frames;	/*number of the decoded frames */
@@ -95,24 +141,150 @@ typedef struct _GstVPU_Dec {
 	gint dbk_offset_b;
 
 	char *device;
-	struct v4l2_buffer buf_v4l2[NUM_BUFFERS];
-	unsigned char *buf_data[NUM_BUFFERS];
-	unsigned int buf_size[NUM_BUFFERS];
+	GMutex *buf_lock;	/* protects the capture buffer bookkeeping */
+	guint buf_generation;	/* bumped whenever the capture queue is torn down */
+	guint buf_outstanding;	/* capture buffers currently held downstream */
+	guint capture_buffers;	/* requested queue depth, 0 for automatic */
+	guint num_buffers;	/* buffers actually allocated */
+	struct v4l2_buffer *buf_v4l2;
+	unsigned char **buf_data;
+	unsigned int *buf_size;
+	int *buf_dmabuf;	/* exported capture buffers, -1 if not */
+	gboolean export_dmabuf;	/* hand out capture buffers as dmabufs */
 	int vpu_fd;
+	int wakeup_fd[2];	/* readable while flushing */
+	gboolean flushing;
+	gboolean eos;		/* draining, the output task forwards EOS */
+	gboolean push_list;	/* push ready frames as one buffer list */
+	gboolean keyframe_only;	/* decode intra pictures only */
+	gboolean trick_mode;	/* segment rate asks for intra pictures only */
+	gint iframe_state;	/* mode set in the driver, -1 if unknown */
+	gint skip_state;	/* skipping set in the driver, -1 if unknown */
+	gboolean low_latency;	/* no reordering for streams without B pictures */
+	gint low_delay_state;	/* mode set in the driver, -1 if unknown */
+	guint output_interval;	/* output every nth decoded picture only */
+	guint interval_state;	/* interval set in the driver */
+	struct v4l2_rect roi;	/* window of interest, empty for all */
+	GstFlowReturn output_flow;	/* last flow return of the output task */
 
 	int once;
 
 	GstState state;
 
 	unsigned long streamtype;
-	GstBuffer *buf_gst[NUM_BUFFERS];
+	GstBuffer **buf_gst;	/* buffers held downstream */
+	GstBuffer **buf_pool;	/* userptr: memory backing the capture buffers */
+	guint64 pool_hits;	/* frames pushed without allocating */
+	guint64 pool_misses;	/* frames copied into a new buffer */
+
+	gboolean has_pts;	/* upstream provides timestamps */
+	GstClockTime in_ts[MAX_TIMESTAMPS];
+	GstClockTime in_duration[MAX_TIMESTAMPS];
+	guint in_idx;
+
+	GstAdapter *adapter;	/* collects the next access unit */
+	guint scan_ofs;		/* start code scan position in the adapter */
+	gboolean au_has_picture;	/* adapter holds picture data */
+	gboolean au_aligned;	/* every buffer ends an access unit */
+
+	gint seq_width;		/* coded size from the last sequence header */
+	gint seq_height;
+	gboolean draining;	/* decoding the rest before a new sequence */
+	GCond *drain_cond;	/* signalled with buf_lock on drain, flush and
+				   state changes */
+
+	gchar *fb_device;	/* overlay framebuffer to render into */
+	MfwGstVpuFb *fb;	/* capture buffers are its pages if set */
+	gint fb_shown;		/* capture buffer on screen, -1 if none */
+	GstSegment segment;	/* to show the pictures at their running time */
+	GstClockID clock_id;	/* pending wait for the next flip */
+
+	gchar *canvas_name;	/* mosaic shared with other decoders */
+	struct vpu_canvas canvas_geom;	/* canvas size and our tile in it */
+	struct _GstVPUDecCanvas *canvas;	/* joined with the capture queue */
+	guint canvas_tile;	/* our bit in the tile masks of the canvas */
+	gboolean canvas_active;	/* the canvas swap waits for our tile */
+	gint canvas_queued;	/* canvas queued to the VPU, -1 if none */
+	GstClockTime canvas_ts;	/* timestamp of our last picture */
+
+	guint frame_cache_size;	/* bytes of pushed pictures kept, 0 for none */
+	MfwGstVpuCache cache;	/* pushed pictures or the GOP played in reverse,
+				   protected by the object lock */
+	gboolean cache_seek;	/* a seek is served from the cache */
+	GList *replay;		/* cached pictures to push again */
+	gboolean reverse_gop;	/* a GOP was written at a negative rate */
+
+	guint input_high;	/* queued bytes at which the streaming thread
+				   waits, 0 to write to the VPU from it */
+	guint input_low;	/* queued bytes at which it resumes */
+	gboolean input_queued;	/* input_high latched when going to PAUSED */
+	GstTask *input_task;	/* writes the queued bitstream to the VPU */
+	GStaticRecMutex input_task_lock;
+	GMutex *input_lock;	/* protects the input queue */
+	GCond *input_cond;	/* signalled with input_lock when the queue
+				   shrinks, on idle and on flushing */
+	GQueue input_queue;	/* buffers and serialized events, oldest first */
+	guint input_bytes;	/* size of the queued buffers */
+	gboolean input_busy;	/* the input task handles an item */
+	gboolean input_flushing;	/* the queue takes no buffers */
+	GstFlowReturn input_flow;	/* last flow return of the input task */
 } GstVPU_Dec;
 
+/*
+ * Several decoders in a process can compose a mosaic in one canvas. The
+ * VPU writes the pictures of every stream straight to the tile of its
+ * decoder, the capture buffers of all decoders being the canvas itself.
+ *
+ * The canvas is double buffered. The VPUs write to the back canvas, and
+ * a decoder stops queueing it once its tile is done. On each display
+ * tick of the decoder owning the canvas, if all tiles are done, the
+ * canvases are swapped and the new front canvas is pushed. The mosaic
+ * runs at the frame rate of the owner's stream, and no faster than the
+ * slowest stream. When the owner stops, the next decoder takes over.
+ * Each decoder is a VPU instance, so there are at most VPU_NUM_INSTANCE
+ * tiles.
+ */
+typedef struct _GstVPUDecCanvas {
+	gchar *name;
+	guint refcount;		/* decoders using the canvas */
+	guint width, height;
+	GstBuffer *buffer[2];	/* the I420 canvases */
+	int dmabuf[2];		/* the canvases in driver memory */
+	guint back;		/* the canvas the VPUs write to */
+	GSList *decoders;	/* decoders using the canvas */
+	guint tiles;		/* tiles of all decoders */
+	guint members;		/* tiles the swap waits for */
+	guint finished;		/* tiles done in the back canvas */
+	GstClockTime next_tick;	/* running time of the next push */
+	GstVPU_Dec *owner;	/* pushes the canvas, NULL if nobody does */
+} GstVPUDecCanvas;
+
+static GStaticMutex mfw_gst_vpudec_canvas_lock = G_STATIC_MUTEX_INIT;
+static GHashTable *mfw_gst_vpudec_canvases;
+
+/*
+ * The capture buffers are pushed downstream without copying. The GstBuffer
+ * wraps the mapped v4l2 buffer or, in userptr mode, the buffer backing it
+ * and queues it back to the VPU once the last reference is dropped. As the
+ * userptr addresses never change, the kernel doesn't need to pin new pages.
+ */
+typedef struct _GstVPUDecBuffer {
+	GstBuffer buffer;
+	GstVPU_Dec *vpu_dec;
+	int index;
+	unsigned int length;	/* length of the mapping */
+	guint generation;
+	GstBuffer *parent;	/* userptr: backing buffer */
+	int dmabuf_fd;		/* own dup of the exported buffer, -1 if not */
+} GstVPUDecBuffer;
+
+#define MFW_GST_TYPE_VPUDEC_BUFFER (mfw_gst_vpudec_buffer_get_type())
+
 /* get the element details */
 static GstElementDetails mfw_gst_vpudec_details =
 GST_ELEMENT_DETAILS("Freescale: Hardware (VPU) Decoder",
 		    "Codec/Decoder/Video",
-		    "Decodes H.264, MPEG4, H263 "
+		    "Decodes H.264, MPEG4, H263, MPEG2, VC-1, DivX, RealVideo "
 		    "Elementary data into YUV 4:2:0 data",
 		    "i.MX series");
 
@@ -140,6 +312,114 @@ static void mfw_gst_vpudec_get_property(GObject *, guint, GValue *,
 					GParamSpec *);
 static gboolean mfw_gst_vpudec_sink_event(GstPad *, GstEvent *);
 static gboolean mfw_gst_vpudec_setcaps(GstPad *, GstCaps *);
+static void mfw_gst_vpudec_alloc_buffers(GstVPU_Dec *, guint);
+
+static GstMiniObjectClass *mfw_gst_vpudec_buffer_parent_class;
+
+static void mfw_gst_vpudec_buffer_finalize(GstVPUDecBuffer *buf)
+{
+	GstVPU_Dec *vpu_dec = buf->vpu_dec;
+	struct v4l2_buffer v4l2_buf;
+
+	g_mutex_lock(vpu_dec->buf_lock);
+
+	if (buf->generation == vpu_dec->buf_generation) {
+		vpu_dec->buf_gst[buf->index] = NULL;
+		vpu_dec->buf_outstanding--;
+
+		v4l2_buf = vpu_dec->buf_v4l2[buf->index];
+		if (ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &v4l2_buf))
+			GST_WARNING_OBJECT(vpu_dec, "requeueing buffer %d failed: %s",
+					buf->index, strerror(errno));
+	} else if (!buf->parent) {
+		/* The capture queue is gone, we hold the last user of the mapping */
+		munmap(GST_BUFFER_DATA(buf), buf->length);
+	}
+
+	g_mutex_unlock(vpu_dec->buf_lock);
+
+	if (buf->parent)
+		gst_buffer_unref(buf->parent);
+	if (buf->dmabuf_fd >= 0)
+		close(buf->dmabuf_fd);
+
+	GST_BUFFER_DATA(buf) = NULL;
+	gst_object_unref(vpu_dec);
+
+	mfw_gst_vpudec_buffer_parent_class->finalize(GST_MINI_OBJECT(buf));
+}
+
+static void mfw_gst_vpudec_buffer_class_init(gpointer g_class, gpointer class_data)
+{
+	GstMiniObjectClass *mini_object_class = GST_MINI_OBJECT_CLASS(g_class);
+
+	mfw_gst_vpudec_buffer_parent_class = g_type_class_peek_parent(g_class);
+	mini_object_class->finalize =
+		(GstMiniObjectFinalizeFunction) mfw_gst_vpudec_buffer_finalize;
+}
+
+static GType mfw_gst_vpudec_buffer_get_type(void)
+{
+	static GType vpudec_buffer_type = 0;
+
+	if (!vpudec_buffer_type) {
+		static const GTypeInfo vpudec_buffer_info = {
+			sizeof (GstBufferClass),
+			NULL,
+			NULL,
+			mfw_gst_vpudec_buffer_class_init,
+			NULL,
+			NULL,
+			sizeof (GstVPUDecBuffer),
+			0,
+			NULL,
+		};
+		vpudec_buffer_type = g_type_register_static(GST_TYPE_BUFFER,
+							 "GstVPUDecBuffer",
+							 &vpudec_buffer_info, 0);
+	}
+	return vpudec_buffer_type;
+}
+
+/* Caller must hold buf_lock */
+static GstBuffer *mfw_gst_vpudec_buffer_new(GstVPU_Dec *vpu_dec, int index)
+{
+	GstVPUDecBuffer *buf;
+
+	buf = (GstVPUDecBuffer *)gst_mini_object_new(MFW_GST_TYPE_VPUDEC_BUFFER);
+
+	buf->vpu_dec = gst_object_ref(vpu_dec);
+	buf->index = index;
+	buf->length = vpu_dec->buf_size[index];
+	buf->generation = vpu_dec->buf_generation;
+	if (vpu_dec->streamtype == V4L2_MEMORY_USERPTR)
+		buf->parent = gst_buffer_ref(vpu_dec->buf_pool[index]);
+
+	GST_BUFFER_DATA(buf) = vpu_dec->buf_data[index];
+	GST_BUFFER_SIZE(buf) = vpu_dec->outsize;
+
+	/*
+	 * The buffer carries its own fd, the exported ones are closed with
+	 * the capture queue while buffers may still be held downstream.
+	 * See MFW_GST_VPUDEC_DMABUF_FIELD for how it is handed out.
+	 */
+	buf->dmabuf_fd = -1;
+	if (vpu_dec->buf_dmabuf[index] >= 0) {
+		buf->dmabuf_fd = fcntl(vpu_dec->buf_dmabuf[index],
+				F_DUPFD_CLOEXEC, 0);
+		if (buf->dmabuf_fd < 0)
+			GST_WARNING_OBJECT(vpu_dec, "duplicating dmabuf failed: %s",
+					strerror(errno));
+	}
+	GST_BUFFER_OFFSET(buf) = buf->dmabuf_fd >= 0 ?
+		(guint64) buf->dmabuf_fd : GST_BUFFER_OFFSET_NONE;
+	gst_buffer_set_caps(GST_BUFFER(buf), GST_PAD_CAPS(vpu_dec->srcpad));
+
+	vpu_dec->buf_gst[index] = GST_BUFFER(buf);
+	vpu_dec->buf_outstanding++;
+
+	return GST_BUFFER(buf);
+}
 
 static void
 mfw_gst_vpudec_set_property(GObject * object, guint prop_id,
@@ -191,6 +471,112 @@ mfw_gst_vpudec_set_property(GObject * object, guint prop_id,
 			break;
 		}
 		break;
+
+	case MFW_GST_VPU_PUSH_LIST:
+		vpu_dec->push_list = g_value_get_boolean(value);
+		break;
+
+	case MFW_GST_VPU_CAPTURE_BUFFERS:
+		vpu_dec->capture_buffers = g_value_get_uint(value);
+		break;
+
+	case MFW_GST_VPU_KEYFRAME_ONLY:
+		/* applied by the streaming thread with the next buffer */
+		vpu_dec->keyframe_only = g_value_get_boolean(value);
+		break;
+
+	case MFW_GST_VPU_LOW_LATENCY:
+		/* applied with the next sequence header */
+		vpu_dec->low_latency = g_value_get_boolean(value);
+		break;
+
+	case MFW_GST_VPU_CROP_WINDOW:
+		/* applied when the decoder is set up for the next sequence */
+		memset(&vpu_dec->roi, 0, sizeof(vpu_dec->roi));
+		if (g_value_get_string(value) &&
+				sscanf(g_value_get_string(value), "%d,%d,%u,%u",
+					&vpu_dec->roi.left, &vpu_dec->roi.top,
+					&vpu_dec->roi.width, &vpu_dec->roi.height) != 4) {
+			memset(&vpu_dec->roi, 0, sizeof(vpu_dec->roi));
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		}
+		break;
+
+	case MFW_GST_VPU_CANVAS:
+		/* used when the capture buffers are set up next */
+		g_free(vpu_dec->canvas_name);
+		vpu_dec->canvas_name = g_strdup(g_value_get_string(value));
+		break;
+
+	case MFW_GST_VPU_CANVAS_SIZE:
+		vpu_dec->canvas_geom.width = vpu_dec->canvas_geom.height = 0;
+		if (g_value_get_string(value) &&
+				sscanf(g_value_get_string(value), "%ux%u",
+					&vpu_dec->canvas_geom.width,
+					&vpu_dec->canvas_geom.height) != 2) {
+			vpu_dec->canvas_geom.width = vpu_dec->canvas_geom.height = 0;
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		}
+		break;
+
+	case MFW_GST_VPU_CANVAS_TILE:
+		vpu_dec->canvas_geom.x = vpu_dec->canvas_geom.y = 0;
+		if (g_value_get_string(value) &&
+				sscanf(g_value_get_string(value), "%u,%u",
+					&vpu_dec->canvas_geom.x,
+					&vpu_dec->canvas_geom.y) != 2) {
+			vpu_dec->canvas_geom.x = vpu_dec->canvas_geom.y = 0;
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		}
+		break;
+
+	case MFW_GST_VPU_FRAME_CACHE_SIZE:
+		vpu_dec->frame_cache_size = g_value_get_uint(value);
+		if (!vpu_dec->frame_cache_size) {
+			GST_OBJECT_LOCK(vpu_dec);
+			mfw_gst_vpu_cache_clear(&vpu_dec->cache);
+			GST_OBJECT_UNLOCK(vpu_dec);
+		}
+		break;
+
+	case MFW_GST_VPU_INPUT_QUEUE_HIGH:
+	case MFW_GST_VPU_INPUT_QUEUE_LOW:
+		g_mutex_lock(vpu_dec->input_lock);
+		if (prop_id == MFW_GST_VPU_INPUT_QUEUE_HIGH)
+			vpu_dec->input_high = g_value_get_uint(value);
+		else
+			vpu_dec->input_low = g_value_get_uint(value);
+		/* a waiting streaming thread checks the new watermarks */
+		g_cond_broadcast(vpu_dec->input_cond);
+		g_mutex_unlock(vpu_dec->input_lock);
+		break;
+
+	case MFW_GST_VPU_OUTPUT_INTERVAL:
+		/* applied when the decoder is set up for the next sequence */
+		vpu_dec->output_interval = g_value_get_uint(value);
+		break;
+
+	case MFW_GST_VPU_EXPORT_DMABUF:
+		/* used when the capture buffers are set up next */
+		vpu_dec->export_dmabuf = g_value_get_boolean(value);
+		break;
+
+	case MFW_GST_VPU_FB_DEVICE:
+		/* used when the capture buffers are set up next */
+		g_free(vpu_dec->fb_device);
+		vpu_dec->fb_device = g_strdup(g_value_get_string(value));
+		GST_DEBUG("fb-device=%s", vpu_dec->fb_device);
+
+		/*
+		 * The element displays the pictures, the bin waits for its
+		 * EOS message. It is posted even if the framebuffer can't be
+		 * used and the pictures go downstream instead.
+		 */
+		if (vpu_dec->fb_device)
+			GST_OBJECT_FLAG_SET(vpu_dec, GST_ELEMENT_IS_SINK);
+		else
+			GST_OBJECT_FLAG_UNSET(vpu_dec, GST_ELEMENT_IS_SINK);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
 		break;
@@ -226,6 +612,63 @@ mfw_gst_vpudec_get_property(GObject * object, guint prop_id,
 	case MFW_GST_VPU_ROTATION:
 		g_value_set_uint(value, vpu_dec->rotation_angle);
 		break;
+	case MFW_GST_VPU_PUSH_LIST:
+		g_value_set_boolean(value, vpu_dec->push_list);
+		break;
+	case MFW_GST_VPU_CAPTURE_BUFFERS:
+		g_value_set_uint(value, vpu_dec->capture_buffers);
+		break;
+	case MFW_GST_VPU_POOL_HITS:
+		g_value_set_uint64(value, vpu_dec->pool_hits);
+		break;
+	case MFW_GST_VPU_POOL_MISSES:
+		g_value_set_uint64(value, vpu_dec->pool_misses);
+		break;
+	case MFW_GST_VPU_KEYFRAME_ONLY:
+		g_value_set_boolean(value, vpu_dec->keyframe_only);
+		break;
+	case MFW_GST_VPU_LOW_LATENCY:
+		g_value_set_boolean(value, vpu_dec->low_latency);
+		break;
+	case MFW_GST_VPU_FB_DEVICE:
+		g_value_set_string(value, vpu_dec->fb_device);
+		break;
+	case MFW_GST_VPU_EXPORT_DMABUF:
+		g_value_set_boolean(value, vpu_dec->export_dmabuf);
+		break;
+	case MFW_GST_VPU_OUTPUT_INTERVAL:
+		g_value_set_uint(value, vpu_dec->output_interval);
+		break;
+	case MFW_GST_VPU_FRAME_CACHE_SIZE:
+		g_value_set_uint(value, vpu_dec->frame_cache_size);
+		break;
+	case MFW_GST_VPU_INPUT_QUEUE_HIGH:
+		g_value_set_uint(value, vpu_dec->input_high);
+		break;
+	case MFW_GST_VPU_INPUT_QUEUE_LOW:
+		g_value_set_uint(value, vpu_dec->input_low);
+		break;
+	case MFW_GST_VPU_CANVAS:
+		g_value_set_string(value, vpu_dec->canvas_name);
+		break;
+	case MFW_GST_VPU_CANVAS_SIZE:
+		g_value_take_string(value, g_strdup_printf("%ux%u",
+				vpu_dec->canvas_geom.width,
+				vpu_dec->canvas_geom.height));
+		break;
+	case MFW_GST_VPU_CANVAS_TILE:
+		g_value_take_string(value, g_strdup_printf("%u,%u",
+				vpu_dec->canvas_geom.x,
+				vpu_dec->canvas_geom.y));
+		break;
+	case MFW_GST_VPU_CROP_WINDOW:
+		if (vpu_dec->roi.width && vpu_dec->roi.height)
+			g_value_take_string(value, g_strdup_printf("%d,%d,%u,%u",
+					vpu_dec->roi.left, vpu_dec->roi.top,
+					vpu_dec->roi.width, vpu_dec->roi.height));
+		else
+			g_value_set_string(value, NULL);
+		break;
 
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
@@ -234,29 +677,424 @@ mfw_gst_vpudec_get_property(GObject * object, guint prop_id,
 	return;
 }
 
+#ifdef VIDIOC_EXPBUF
+/* the driver memory behind a canvas, freed with the last buffer using it */
+typedef struct {
+	void *data;
+	size_t length;
+	int dmabuf;
+} GstVPUDecCanvasMem;
+
+static void mfw_gst_vpudec_canvas_free(gpointer data)
+{
+	GstVPUDecCanvasMem *mem = data;
+
+	munmap(mem->data, mem->length);
+	close(mem->dmabuf);
+	g_free(mem);
+}
+#endif
+
+/*
+ * All VPU instances of the mosaic write to the canvas, so it has to be
+ * contiguous memory of the driver. The front and back canvas are the
+ * capture buffers of the decoder allocating them and exported for the
+ * others. Needs a 3.8 kernel.
+ */
+static gboolean mfw_gst_vpudec_canvas_alloc(GstVPU_Dec *vpu_dec,
+		GstVPUDecCanvas *canvas)
+{
+#ifdef VIDIOC_EXPBUF
+	struct v4l2_requestbuffers reqs = {
+		.count	= G_N_ELEMENTS(canvas->buffer),
+		.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory	= V4L2_MEMORY_MMAP,
+	};
+	struct v4l2_buffer *buf;
+	GstVPUDecCanvasMem *mem;
+	GstBuffer *buffer;
+	void *data;
+	guint i;
+
+	if (ioctl(vpu_dec->vpu_fd, VIDIOC_REQBUFS, &reqs) ||
+			reqs.count != G_N_ELEMENTS(canvas->buffer)) {
+		GST_ERROR_OBJECT(vpu_dec, "VIDIOC_REQBUFS for the canvas failed: %s",
+				strerror(errno));
+		return FALSE;
+	}
+
+	mfw_gst_vpudec_alloc_buffers(vpu_dec, reqs.count);
+	vpu_dec->streamtype = V4L2_MEMORY_MMAP;
+
+	for (i = 0; i < reqs.count; i++) {
+		struct v4l2_exportbuffer expbuf = {
+			.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE,
+			.index	= i,
+			.flags	= O_CLOEXEC | O_RDWR,
+		};
+
+		buf = &vpu_dec->buf_v4l2[i];
+		buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf->memory = V4L2_MEMORY_MMAP;
+		buf->index = i;
+
+		if (ioctl(vpu_dec->vpu_fd, VIDIOC_QUERYBUF, buf) ||
+				ioctl(vpu_dec->vpu_fd, VIDIOC_EXPBUF, &expbuf)) {
+			GST_ERROR_OBJECT(vpu_dec, "exporting the canvas failed: %s",
+					strerror(errno));
+			goto err_out;
+		}
+
+		data = mmap(NULL, buf->length, PROT_READ | PROT_WRITE,
+				MAP_SHARED, vpu_dec->vpu_fd, buf->m.offset);
+		if (data == MAP_FAILED) {
+			GST_ERROR_OBJECT(vpu_dec, "mapping the canvas failed: %s",
+					strerror(errno));
+			close(expbuf.fd);
+			goto err_out;
+		}
+		vpu_dec->buf_size[i] = buf->length;
+		vpu_dec->buf_data[i] = data;
+
+		mem = g_new(GstVPUDecCanvasMem, 1);
+		mem->data = data;
+		mem->length = buf->length;
+		mem->dmabuf = expbuf.fd;
+
+		/* pushed parts of the canvas keep the mapping */
+		buffer = gst_buffer_new();
+		GST_BUFFER_DATA(buffer) = data;
+		GST_BUFFER_SIZE(buffer) = buf->length;
+		GST_BUFFER_MALLOCDATA(buffer) = (guint8 *) mem;
+		GST_BUFFER_FREE_FUNC(buffer) = mfw_gst_vpudec_canvas_free;
+		gst_buffer_set_caps(buffer, GST_PAD_CAPS(vpu_dec->srcpad));
+
+		canvas->buffer[i] = buffer;
+		canvas->dmabuf[i] = expbuf.fd;
+	}
+
+	return TRUE;
+
+err_out:
+	/* the buffers own the mappings made so far */
+	for (i = 0; i < reqs.count; i++) {
+		if (canvas->buffer[i])
+			gst_buffer_unref(canvas->buffer[i]);
+		canvas->buffer[i] = NULL;
+		vpu_dec->buf_data[i] = NULL;
+	}
+
+	return FALSE;
+#else
+	GST_ERROR_OBJECT(vpu_dec, "built without dmabuf support, "
+			"which the canvas needs");
+	return FALSE;
+#endif
+}
+
+/*
+ * Look up the canvas by name, allocating it from the driver of the first
+ * decoder that joins.
+ */
+static GstVPUDecCanvas *mfw_gst_vpudec_canvas_join(GstVPU_Dec *vpu_dec)
+{
+	GstVPUDecCanvas *canvas;
+	guint size, i;
+
+	g_static_mutex_lock(&mfw_gst_vpudec_canvas_lock);
+
+	if (!mfw_gst_vpudec_canvases)
+		mfw_gst_vpudec_canvases = g_hash_table_new(g_str_hash,
+				g_str_equal);
+
+	canvas = g_hash_table_lookup(mfw_gst_vpudec_canvases,
+			vpu_dec->canvas_name);
+	if (canvas) {
+		if (canvas->width != vpu_dec->canvas_geom.width ||
+				canvas->height != vpu_dec->canvas_geom.height) {
+			GST_ERROR_OBJECT(vpu_dec, "canvas %s is %dx%d",
+					canvas->name, canvas->width,
+					canvas->height);
+			canvas = NULL;
+			goto out;
+		}
+		canvas->refcount++;
+		goto tile;
+	}
+
+	size = vpu_dec->canvas_geom.width * vpu_dec->canvas_geom.height * 3 / 2;
+	canvas = g_new0(GstVPUDecCanvas, 1);
+
+	if (!mfw_gst_vpudec_canvas_alloc(vpu_dec, canvas)) {
+		GST_ERROR_OBJECT(vpu_dec, "allocating canvas %s failed",
+				vpu_dec->canvas_name);
+		g_free(canvas);
+		canvas = NULL;
+		goto out;
+	}
+
+	/* tiles without a picture yet stay black */
+	for (i = 0; i < G_N_ELEMENTS(canvas->buffer); i++) {
+		memset(GST_BUFFER_DATA(canvas->buffer[i]), 16, size * 2 / 3);
+		memset(GST_BUFFER_DATA(canvas->buffer[i]) + size * 2 / 3, 128,
+				size / 3);
+	}
+
+	canvas->name = g_strdup(vpu_dec->canvas_name);
+	canvas->refcount = 1;
+	canvas->width = vpu_dec->canvas_geom.width;
+	canvas->height = vpu_dec->canvas_geom.height;
+	canvas->next_tick = GST_CLOCK_TIME_NONE;
+	canvas->owner = vpu_dec;
+	g_hash_table_insert(mfw_gst_vpudec_canvases, canvas->name, canvas);
+
+	GST_INFO_OBJECT(vpu_dec, "pushing %dx%d canvas %s", canvas->width,
+			canvas->height, canvas->name);
+tile:
+	/* the lowest free bit, there are fewer VPU instances than bits */
+	vpu_dec->canvas_tile = ~canvas->tiles & (canvas->tiles + 1);
+	canvas->tiles |= vpu_dec->canvas_tile;
+	canvas->decoders = g_slist_prepend(canvas->decoders, vpu_dec);
+	vpu_dec->canvas_active = FALSE;
+	vpu_dec->canvas_queued = -1;
+	vpu_dec->canvas_ts = GST_CLOCK_TIME_NONE;
+out:
+	g_static_mutex_unlock(&mfw_gst_vpudec_canvas_lock);
+
+	return canvas;
+}
+
+/* Queue the back canvas to the VPU, with the canvas lock held */
+static void mfw_gst_vpudec_canvas_queue(GstVPU_Dec *vpu_dec)
+{
+	GstVPUDecCanvas *canvas = vpu_dec->canvas;
+	struct v4l2_buffer buf;
+
+	if (vpu_dec->canvas_queued >= 0)
+		return;
+
+	buf = vpu_dec->buf_v4l2[canvas->back];
+	if (ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &buf)) {
+		GST_WARNING_OBJECT(vpu_dec, "VIDIOC_QBUF of the canvas failed: %s",
+				strerror(errno));
+		return;
+	}
+	vpu_dec->canvas_queued = canvas->back;
+}
+
+/* Take part in the mosaic, the next swap waits for our tile */
+static void mfw_gst_vpudec_canvas_activate(GstVPU_Dec *vpu_dec)
+{
+	GstVPUDecCanvas *canvas = vpu_dec->canvas;
+
+	if (!canvas)
+		return;
+
+	g_static_mutex_lock(&mfw_gst_vpudec_canvas_lock);
+	if (!vpu_dec->canvas_active) {
+		vpu_dec->canvas_active = TRUE;
+		canvas->members |= vpu_dec->canvas_tile;
+		canvas->finished &= ~vpu_dec->canvas_tile;
+		mfw_gst_vpudec_canvas_queue(vpu_dec);
+	}
+	g_static_mutex_unlock(&mfw_gst_vpudec_canvas_lock);
+}
+
+/*
+ * Stop holding up the mosaic and pushing it, the next decoder with a
+ * display tick takes over. With the canvas lock held.
+ */
+static void mfw_gst_vpudec_canvas_retire_locked(GstVPU_Dec *vpu_dec)
+{
+	GstVPUDecCanvas *canvas = vpu_dec->canvas;
+
+	vpu_dec->canvas_active = FALSE;
+	canvas->members &= ~vpu_dec->canvas_tile;
+	canvas->finished &= ~vpu_dec->canvas_tile;
+	if (canvas->owner == vpu_dec)
+		canvas->owner = NULL;
+}
+
+static void mfw_gst_vpudec_canvas_retire(GstVPU_Dec *vpu_dec)
+{
+	if (!vpu_dec->canvas)
+		return;
+
+	g_static_mutex_lock(&mfw_gst_vpudec_canvas_lock);
+	mfw_gst_vpudec_canvas_retire_locked(vpu_dec);
+	g_static_mutex_unlock(&mfw_gst_vpudec_canvas_lock);
+}
+
+static void mfw_gst_vpudec_canvas_leave(GstVPU_Dec *vpu_dec)
+{
+	GstVPUDecCanvas *canvas = vpu_dec->canvas;
+	guint i;
+
+	g_static_mutex_lock(&mfw_gst_vpudec_canvas_lock);
+
+	mfw_gst_vpudec_canvas_retire_locked(vpu_dec);
+	canvas->decoders = g_slist_remove(canvas->decoders, vpu_dec);
+	canvas->tiles &= ~vpu_dec->canvas_tile;
+	vpu_dec->canvas_queued = -1;
+
+	if (!--canvas->refcount) {
+		g_hash_table_remove(mfw_gst_vpudec_canvases, canvas->name);
+		for (i = 0; i < G_N_ELEMENTS(canvas->buffer); i++)
+			gst_buffer_unref(canvas->buffer[i]);
+		g_free(canvas->name);
+		g_free(canvas);
+	}
+
+	g_static_mutex_unlock(&mfw_gst_vpudec_canvas_lock);
+
+	vpu_dec->canvas = NULL;
+}
+
 static void mfw_gst_vpudec_buffers_unref(GstVPU_Dec *vpu_dec)
 {
+	gboolean canvas = vpu_dec->canvas != NULL;
 	int i;
 
-	if (vpu_dec->streamtype == V4L2_MEMORY_MMAP) {
-		for (i = 0; i < NUM_BUFFERS; ++i){
-			struct v4l2_buffer *buf = &vpu_dec->buf_v4l2[i];
-			munmap(vpu_dec->buf_data[i], buf->length);
-		}
-	} else  {
-		for (i = 0; i < NUM_BUFFERS; i++) {
-			if (vpu_dec->buf_gst[i])
-				gst_buffer_unref(vpu_dec->buf_gst[i]);
+	/* before the buffers are gone, other decoders queue them on a swap */
+	if (canvas) {
+		struct vpu_canvas none = { 0, };
+
+		mfw_gst_vpudec_canvas_leave(vpu_dec);
+		ioctl(vpu_dec->vpu_fd, VPU_IOC_CANVAS, &none);
+	}
+
+	g_mutex_lock(vpu_dec->buf_lock);
+	for (i = 0; i < vpu_dec->num_buffers; ++i){
+		struct v4l2_buffer *buf = &vpu_dec->buf_v4l2[i];
+
+		/*
+		 * buffers still held downstream unmap themselves or keep
+		 * their backing buffer alive
+		 */
+		if (vpu_dec->buf_gst[i])
 			vpu_dec->buf_gst[i] = NULL;
-		}
+		else if (vpu_dec->streamtype == V4L2_MEMORY_MMAP &&
+				!canvas && vpu_dec->buf_data[i])
+			munmap(vpu_dec->buf_data[i], buf->length);
+
+		if (vpu_dec->buf_pool[i])
+			gst_buffer_unref(vpu_dec->buf_pool[i]);
+
+		/* pushed buffers and importers hold their own fds */
+		if (vpu_dec->buf_dmabuf[i] >= 0)
+			close(vpu_dec->buf_dmabuf[i]);
+	}
+	vpu_dec->buf_generation++;
+	vpu_dec->buf_outstanding = 0;
+	g_mutex_unlock(vpu_dec->buf_lock);
+
+	g_free(vpu_dec->buf_v4l2);
+	g_free(vpu_dec->buf_data);
+	g_free(vpu_dec->buf_size);
+	g_free(vpu_dec->buf_gst);
+	g_free(vpu_dec->buf_pool);
+	g_free(vpu_dec->buf_dmabuf);
+	vpu_dec->buf_v4l2 = NULL;
+	vpu_dec->buf_data = NULL;
+	vpu_dec->buf_size = NULL;
+	vpu_dec->buf_gst = NULL;
+	vpu_dec->buf_pool = NULL;
+	vpu_dec->buf_dmabuf = NULL;
+	vpu_dec->num_buffers = 0;
+
+	if (vpu_dec->fb) {
+		mfw_gst_vpu_fb_close(vpu_dec->fb);
+		vpu_dec->fb = NULL;
+	}
+	vpu_dec->fb_shown = -1;
+}
+
+static void mfw_gst_vpudec_alloc_buffers(GstVPU_Dec *vpu_dec, guint count)
+{
+	guint i;
+
+	vpu_dec->buf_v4l2 = g_new0(struct v4l2_buffer, count);
+	vpu_dec->buf_data = g_new0(unsigned char *, count);
+	vpu_dec->buf_size = g_new0(unsigned int, count);
+	vpu_dec->buf_gst = g_new0(GstBuffer *, count);
+	vpu_dec->buf_pool = g_new0(GstBuffer *, count);
+	vpu_dec->buf_dmabuf = g_new(int, count);
+	for (i = 0; i < count; i++)
+		vpu_dec->buf_dmabuf[i] = -1;
+	vpu_dec->num_buffers = count;
+}
+
+/*
+ * Export a mapped capture buffer as dmabuf so that hardware downstream
+ * imports the picture instead of copying it. Needs a 3.8 kernel.
+ */
+static void mfw_gst_vpudec_export_buffer(GstVPU_Dec *vpu_dec, int index)
+{
+#ifdef VIDIOC_EXPBUF
+	struct v4l2_exportbuffer expbuf = {
+		.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.index	= index,
+		.flags	= O_CLOEXEC | O_RDWR,
+	};
+
+	if (ioctl(vpu_dec->vpu_fd, VIDIOC_EXPBUF, &expbuf)) {
+		GST_WARNING_OBJECT(vpu_dec, "VIDIOC_EXPBUF failed: %s",
+				strerror(errno));
+		return;
+	}
+
+	vpu_dec->buf_dmabuf[index] = expbuf.fd;
+#else
+	GST_WARNING_OBJECT(vpu_dec, "built without dmabuf support");
+#endif
+}
+
+/*
+ * Number of capture buffers to request. Unless set explicitly this is
+ * enough to cover the reorder delay of the stream, one picture being
+ * decoded, one being displayed and the latency of downstream.
+ */
+static guint mfw_gst_vpudec_get_num_buffers(GstVPU_Dec *vpu_dec)
+{
+	GstQuery *query;
+	GstClockTime min_latency;
+	gboolean live;
+	guint count;
+	int delay;
+
+	if (vpu_dec->capture_buffers)
+		return vpu_dec->capture_buffers;
+
+	delay = ioctl(vpu_dec->vpu_fd, VPU_IOC_FRAME_DELAY);
+	if (delay < 0)
+		delay = 0;
+
+	count = MIN_BUFFERS + delay;
+
+	query = gst_query_new_latency();
+	if (gst_pad_peer_query(vpu_dec->srcpad, query) &&
+			vpu_dec->frame_rate_nu > 0 && vpu_dec->frame_rate_de > 0) {
+		gst_query_parse_latency(query, &live, &min_latency, NULL);
+		if (GST_CLOCK_TIME_IS_VALID(min_latency))
+			count += gst_util_uint64_scale_ceil(min_latency,
+					vpu_dec->frame_rate_nu,
+					vpu_dec->frame_rate_de * GST_SECOND);
 	}
+	gst_query_unref(query);
+
+	count = CLAMP(count, MIN_BUFFERS, MAX_BUFFERS);
+
+	GST_DEBUG_OBJECT(vpu_dec, "frame delay %d, using %d capture buffers",
+			delay, count);
+
+	return count;
 }
 
 static int mfw_gst_vpudec_reqbufs_userp(GstVPU_Dec *vpu_dec)
 {
 	int ret, i;
 	struct v4l2_requestbuffers reqs = {
-		.count	= NUM_BUFFERS,
+		.count	= mfw_gst_vpudec_get_num_buffers(vpu_dec),
 		.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE,
 		.memory	= V4L2_MEMORY_USERPTR,
 	};
@@ -270,7 +1108,9 @@ static int mfw_gst_vpudec_reqbufs_userp(GstVPU_Dec *vpu_dec)
 		return -errno;
 	}
 
-	for (i = 0; i < NUM_BUFFERS; i++) {
+	mfw_gst_vpudec_alloc_buffers(vpu_dec, reqs.count);
+
+	for (i = 0; i < vpu_dec->num_buffers; i++) {
 		struct v4l2_buffer *buf = &vpu_dec->buf_v4l2[i];
 		buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf->memory = V4L2_MEMORY_USERPTR;
@@ -280,7 +1120,7 @@ static int mfw_gst_vpudec_reqbufs_userp(GstVPU_Dec *vpu_dec)
 		ret = gst_pad_alloc_buffer_and_set_caps(vpu_dec->srcpad, 0,
 						      buf->length,
 						      GST_PAD_CAPS(vpu_dec->srcpad),
-						      &vpu_dec->buf_gst[i]);
+						      &vpu_dec->buf_pool[i]);
 		if (ret != GST_FLOW_OK) {
 			GST_DEBUG_OBJECT(vpu_dec, "Allocating the Framebuffer[%d] failed with %d",
 			     0, ret);
@@ -288,12 +1128,12 @@ static int mfw_gst_vpudec_reqbufs_userp(GstVPU_Dec *vpu_dec)
 		}
 
 		vpu_dec->buf_size[i] = buf->length;
-		vpu_dec->buf_data[i] = GST_BUFFER_DATA(vpu_dec->buf_gst[i]);
+		vpu_dec->buf_data[i] = GST_BUFFER_DATA(vpu_dec->buf_pool[i]);
 
 		buf->m.userptr = (unsigned long)vpu_dec->buf_data[i];
 	}
 
-	for (i = 0; i < NUM_BUFFERS; ++i){
+	for (i = 0; i < vpu_dec->num_buffers; ++i){
 		ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &vpu_dec->buf_v4l2[i]);
 		if (ret) {
 			GST_DEBUG_OBJECT(vpu_dec, "VIDIOC_QBUF with type userptr failed: %s\n",
@@ -320,7 +1160,7 @@ static int mfw_gst_vpudec_reqbufs_mmap(GstVPU_Dec *vpu_dec)
 {
 	int ret, i;
 	struct v4l2_requestbuffers reqs = {
-		.count	= NUM_BUFFERS,
+		.count	= mfw_gst_vpudec_get_num_buffers(vpu_dec),
 		.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE,
 		.memory	= V4L2_MEMORY_MMAP,
 	};
@@ -331,70 +1171,315 @@ static int mfw_gst_vpudec_reqbufs_mmap(GstVPU_Dec *vpu_dec)
 		return -errno;
 	}
 
-	for (i = 0; i < NUM_BUFFERS; i++) {
+	mfw_gst_vpudec_alloc_buffers(vpu_dec, reqs.count);
+	/* buffers_unref unmaps what has been mapped if we fail */
+	vpu_dec->streamtype = V4L2_MEMORY_MMAP;
+
+	for (i = 0; i < vpu_dec->num_buffers; i++) {
 		struct v4l2_buffer *buf = &vpu_dec->buf_v4l2[i];
+		void *data;
+
 		buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf->memory = V4L2_MEMORY_MMAP;
 		buf->index = i;
 
 		vpu_dec->buf_data[i] = NULL;
+		vpu_dec->buf_gst[i] = NULL;
 		ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QUERYBUF, buf);
 		if (ret) {
 			GST_ERROR("VIDIOC_QUERYBUF failed: %s\n", strerror(errno));
-			return -errno;
+			goto err_out;
 		}
 		vpu_dec->buf_size[i] = buf->length;
-		vpu_dec->buf_data[i] = mmap(NULL, buf->length,
-				   PROT_READ | PROT_WRITE, MAP_SHARED,
-				   vpu_dec->vpu_fd, vpu_dec->buf_v4l2[i].m.offset);
-
-		if (!vpu_dec->buf_data[i])
+		data = mmap(NULL, buf->length, PROT_READ | PROT_WRITE,
+				MAP_SHARED, vpu_dec->vpu_fd,
+				vpu_dec->buf_v4l2[i].m.offset);
+		if (data == MAP_FAILED) {
 			GST_ERROR("MMAP failed: %s\n", strerror(errno));
+			goto err_out;
+		}
+		vpu_dec->buf_data[i] = data;
+
+		if (vpu_dec->export_dmabuf)
+			mfw_gst_vpudec_export_buffer(vpu_dec, i);
 	}
 
-	for (i = 0; i < NUM_BUFFERS; ++i){
+	for (i = 0; i < vpu_dec->num_buffers; ++i){
 		ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &vpu_dec->buf_v4l2[i]);
 		if (ret) {
 			GST_ERROR("VIDIOC_QBUF failed: %s\n", strerror(errno));
-			return -errno;
+			goto err_out;
 		}
 	}
 
-	vpu_dec->streamtype = V4L2_MEMORY_MMAP;
-
 	return 0;
+
+err_out:
+	ret = -errno;
+	mfw_gst_vpudec_buffers_unref(vpu_dec);
+
+	/* the queue isn't streaming yet, this frees queued buffers too */
+	reqs.count = 0;
+	ioctl(vpu_dec->vpu_fd, VIDIOC_REQBUFS, &reqs);
+
+	return ret;
 }
 
-static int mfw_gst_vpudec_reqbufs(GstVPU_Dec *vpu_dec)
+/*
+ * The capture buffers are the front and back canvas. The decoder
+ * allocating the canvas has them as its mmap buffers, the others import
+ * them. Only the back canvas is ever queued to the VPU.
+ */
+static int mfw_gst_vpudec_reqbufs_canvas(GstVPU_Dec *vpu_dec)
 {
-	int ret;
+	int ret, i;
 
-	ret = mfw_gst_vpudec_reqbufs_userp(vpu_dec);
-	if (!ret) {
-		GST_DEBUG_OBJECT(vpu_dec, "using v4l2 userpointer buffers");
+	/* joined before, the buffers are still there */
+	if (vpu_dec->canvas) {
+		mfw_gst_vpudec_canvas_activate(vpu_dec);
 		return 0;
 	}
 
-	ret = mfw_gst_vpudec_reqbufs_mmap(vpu_dec);
-	if (!ret) {
-		GST_DEBUG_OBJECT(vpu_dec, "using v4l2 mmap buffers");
-		return 0;
+	if (!vpu_dec->canvas_geom.width || !vpu_dec->canvas_geom.height) {
+		GST_ELEMENT_ERROR(vpu_dec, RESOURCE, SETTINGS, (NULL),
+				("canvas %s without canvas-size",
+				 vpu_dec->canvas_name));
+		return -EINVAL;
 	}
 
-	return -1;
-}
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_CANVAS, &vpu_dec->canvas_geom)) {
+		GST_ELEMENT_ERROR(vpu_dec, RESOURCE, SETTINGS, (NULL),
+				("VPU_IOC_CANVAS failed: %s", strerror(errno)));
+		return -errno;
+	}
 
-static GstFlowReturn mfw_gst_vpudec_vpu_init(GstVPU_Dec * vpu_dec)
-{
+	vpu_dec->canvas = mfw_gst_vpudec_canvas_join(vpu_dec);
+	if (!vpu_dec->canvas) {
+		mfw_gst_vpudec_buffers_unref(vpu_dec);
+		return -ENOMEM;
+	}
+
+#ifdef VIDIOC_EXPBUF
+	if (!vpu_dec->num_buffers) {
+		struct v4l2_requestbuffers reqs = {
+			.count	= G_N_ELEMENTS(vpu_dec->canvas->buffer),
+			.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE,
+			.memory	= V4L2_MEMORY_DMABUF,
+		};
+
+		ret = ioctl(vpu_dec->vpu_fd, VIDIOC_REQBUFS, &reqs);
+		if (ret || reqs.count != G_N_ELEMENTS(vpu_dec->canvas->buffer)) {
+			GST_ERROR_OBJECT(vpu_dec, "VIDIOC_REQBUFS with type dmabuf failed: %s\n",
+					strerror(errno));
+			ret = ret ? -errno : -ENOMEM;
+			mfw_gst_vpudec_buffers_unref(vpu_dec);
+			return ret;
+		}
+
+		vpu_dec->streamtype = V4L2_MEMORY_DMABUF;
+		mfw_gst_vpudec_alloc_buffers(vpu_dec, reqs.count);
+
+		for (i = 0; i < vpu_dec->num_buffers; i++) {
+			GstBuffer *canvas = vpu_dec->canvas->buffer[i];
+			struct v4l2_buffer *buf = &vpu_dec->buf_v4l2[i];
+
+			buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buf->memory = V4L2_MEMORY_DMABUF;
+			buf->index = i;
+			buf->length = GST_BUFFER_SIZE(canvas);
+			buf->m.fd = vpu_dec->canvas->dmabuf[i];
+
+			vpu_dec->buf_size[i] = buf->length;
+			vpu_dec->buf_data[i] = GST_BUFFER_DATA(canvas);
+		}
+	}
+#endif
+
+	mfw_gst_vpudec_canvas_activate(vpu_dec);
+	if (vpu_dec->canvas_queued < 0) {
+		GST_ERROR_OBJECT(vpu_dec, "queueing the canvas failed");
+		mfw_gst_vpudec_buffers_unref(vpu_dec);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * Decode straight into the pages of an overlay framebuffer. A picture is
+ * shown by panning the display to its page, so it never passes the CPU.
+ */
+static int mfw_gst_vpudec_reqbufs_fb(GstVPU_Dec *vpu_dec, guint32 fourcc)
+{
+	int ret, i;
+	struct v4l2_requestbuffers reqs = {
+		.type	= V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory	= V4L2_MEMORY_USERPTR,
+	};
+
+	/* one more page stays on screen while the next one is decoded */
+	reqs.count = MIN(mfw_gst_vpudec_get_num_buffers(vpu_dec) + 1,
+			MAX_BUFFERS);
+
+	ret = ioctl(vpu_dec->vpu_fd, VIDIOC_REQBUFS, &reqs);
+	if (ret) {
+		GST_DEBUG_OBJECT(vpu_dec, "VIDIOC_REQBUFS with type userptr failed: %s\n",
+				strerror(errno));
+		return -errno;
+	}
+
+	vpu_dec->fb = mfw_gst_vpu_fb_open(vpu_dec->fb_device, fourcc,
+			vpu_dec->width, vpu_dec->height, vpu_dec->outsize,
+			reqs.count);
+	if (!vpu_dec->fb) {
+		GST_ELEMENT_WARNING(vpu_dec, RESOURCE, SETTINGS, (NULL),
+				("%s can't show %dx%d %" GST_FOURCC_FORMAT " pictures",
+				 vpu_dec->fb_device, vpu_dec->width,
+				 vpu_dec->height, GST_FOURCC_ARGS(fourcc)));
+		return -EINVAL;
+	}
+
+	vpu_dec->streamtype = V4L2_MEMORY_USERPTR;
+	mfw_gst_vpudec_alloc_buffers(vpu_dec, reqs.count);
+
+	for (i = 0; i < vpu_dec->num_buffers; i++) {
+		struct v4l2_buffer *buf = &vpu_dec->buf_v4l2[i];
+		buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf->memory = V4L2_MEMORY_USERPTR;
+		buf->index = i;
+		buf->length = vpu_dec->outsize;
+
+		vpu_dec->buf_size[i] = buf->length;
+		vpu_dec->buf_data[i] = mfw_gst_vpu_fb_page(vpu_dec->fb, i);
+		buf->m.userptr = (unsigned long)vpu_dec->buf_data[i];
+	}
+
+	for (i = 0; i < vpu_dec->num_buffers; ++i){
+		ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &vpu_dec->buf_v4l2[i]);
+		if (ret) {
+			GST_DEBUG_OBJECT(vpu_dec, "VIDIOC_QBUF of framebuffer page failed: %s\n",
+					strerror(errno));
+			goto err_out;
+		}
+	}
+
+	vpu_dec->fb_shown = -1;
+
+	return 0;
+
+err_out:
+	ret = -errno;
+	while (i) {
+		i--;
+		ioctl(vpu_dec->vpu_fd, VIDIOC_DQBUF, &vpu_dec->buf_v4l2[i]);
+	}
+	mfw_gst_vpudec_buffers_unref(vpu_dec);
+
+	return ret;
+}
+
+static int mfw_gst_vpudec_reqbufs(GstVPU_Dec *vpu_dec, guint32 fourcc)
+{
+	int ret;
+
+	if (vpu_dec->canvas_name)
+		return mfw_gst_vpudec_reqbufs_canvas(vpu_dec);
+
+	if (vpu_dec->fb_device) {
+		ret = mfw_gst_vpudec_reqbufs_fb(vpu_dec, fourcc);
+		if (!ret) {
+			GST_DEBUG_OBJECT(vpu_dec, "decoding into %s",
+					vpu_dec->fb_device);
+			return 0;
+		}
+	}
+
+	/* only buffers allocated by the driver can be exported */
+	ret = vpu_dec->export_dmabuf ? -EINVAL :
+		mfw_gst_vpudec_reqbufs_userp(vpu_dec);
+	if (!ret) {
+		GST_DEBUG_OBJECT(vpu_dec, "using v4l2 userpointer buffers");
+		return 0;
+	}
+
+	ret = mfw_gst_vpudec_reqbufs_mmap(vpu_dec);
+	if (!ret) {
+		GST_DEBUG_OBJECT(vpu_dec, "using v4l2 mmap buffers");
+		return 0;
+	}
+
+	return -1;
+}
+
+/* output formats the VPU can write, in order of preference */
+static const struct {
+	guint32 fourcc;
+	guint32 pixelformat;
+} mfw_gst_vpudec_formats[] = {
+	{ GST_MAKE_FOURCC('I', '4', '2', '0'), V4L2_PIX_FMT_YUV420 },
+	{ GST_MAKE_FOURCC('N', 'V', '1', '2'), V4L2_PIX_FMT_NV12 },
+	{ GST_MAKE_FOURCC('Y', 'V', '1', '2'), V4L2_PIX_FMT_YVU420 },
+	{ GST_MAKE_FOURCC('Y', '4', '2', 'B'), V4L2_PIX_FMT_YUV422P },
+};
+
+/*
+ * Choose the first format downstream accepts, so that e.g. NV12 for the
+ * IPU is written by the VPU directly instead of being converted.
+ */
+static gint mfw_gst_vpudec_negotiate_format(GstVPU_Dec *vpu_dec)
+{
+	GstCaps *peercaps, *caps, *structcaps;
+	gint i, n, found = 0;
+
+	/* 4:2:2 JPEG pictures are decoded as they are */
+	for (n = 0; vpu_dec->jpeg_422 &&
+			n < G_N_ELEMENTS(mfw_gst_vpudec_formats); n++)
+		if (mfw_gst_vpudec_formats[n].pixelformat == V4L2_PIX_FMT_YUV422P)
+			return n;
+
+	peercaps = gst_pad_peer_get_caps(vpu_dec->srcpad);
+	if (!peercaps)
+		return 0;
+
+	for (i = 0; i < gst_caps_get_size(peercaps); i++) {
+		structcaps = gst_caps_copy_nth(peercaps, i);
+
+		for (n = 0; n < G_N_ELEMENTS(mfw_gst_vpudec_formats); n++) {
+			if (mfw_gst_vpudec_formats[n].pixelformat ==
+					V4L2_PIX_FMT_YUV422P)
+				continue;
+			caps = gst_caps_new_simple("video/x-raw-yuv",
+					"format", GST_TYPE_FOURCC,
+					mfw_gst_vpudec_formats[n].fourcc, NULL);
+			found = gst_caps_can_intersect(caps, structcaps);
+			gst_caps_unref(caps);
+			if (found)
+				break;
+		}
+
+		gst_caps_unref(structcaps);
+		if (found)
+			break;
+	}
+
+	gst_caps_unref(peercaps);
+
+	return found ? n : 0;
+}
+
+static GstFlowReturn mfw_gst_vpudec_vpu_init(GstVPU_Dec * vpu_dec)
+{
 	GstCaps *caps;
 	gint crop_top_len, crop_left_len;
 	gint crop_right_len, crop_bottom_len;
 	gint orgPicW, orgPicH;
 	gint width, height;
-	gint crop_right_by_pixel, crop_bottom_by_pixel;
 	int rotmir;
 	int i, retval;
 	struct v4l2_format fmt;
+	struct v4l2_crop crop = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+	};
 	unsigned long type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
 	switch (vpu_dec->mirror_dir) {
@@ -441,7 +1526,20 @@ static GstFlowReturn mfw_gst_vpudec_vpu_init(GstVPU_Dec * vpu_dec)
 
 	GST_DEBUG("format: %d x %d\n", fmt.fmt.pix.width, fmt.fmt.pix.height);
 
-	gint fourcc = GST_STR_FOURCC("I420");
+	/* the decoders sharing a canvas all write I420 */
+	i = vpu_dec->canvas_name ? 0 : mfw_gst_vpudec_negotiate_format(vpu_dec);
+	fmt.fmt.pix.pixelformat = mfw_gst_vpudec_formats[i].pixelformat;
+	retval = ioctl(vpu_dec->vpu_fd, VIDIOC_S_FMT, &fmt);
+	if (retval || fmt.fmt.pix.pixelformat !=
+			mfw_gst_vpudec_formats[i].pixelformat) {
+		/* older drivers always write I420 */
+		GST_WARNING_OBJECT(vpu_dec, "VIDIOC_S_FMT failed, using I420");
+		i = 0;
+	}
+
+	gint fourcc = mfw_gst_vpudec_formats[i].fourcc;
+	GST_DEBUG_OBJECT(vpu_dec, "output format %" GST_FOURCC_FORMAT,
+			GST_FOURCC_ARGS(fourcc));
 
 	vpu_dec->width = fmt.fmt.pix.width;
 	vpu_dec->height = fmt.fmt.pix.height;
@@ -456,15 +1554,74 @@ static GstFlowReturn mfw_gst_vpudec_vpu_init(GstVPU_Dec * vpu_dec)
 	vpu_dec->width = (vpu_dec->width + 15) / 16 * 16;
 	vpu_dec->height = (vpu_dec->height + 15) / 16 * 16;
 
-	crop_top_len = 0;
-	crop_left_len = 0;
-	crop_right_len = vpu_dec->width - orgPicW;
-	crop_bottom_len = vpu_dec->height - orgPicH;
-
 	width = vpu_dec->width;
 	height = vpu_dec->height;
-	crop_right_by_pixel = (crop_bottom_len + 7) / 8 * 8;
-	crop_bottom_by_pixel = crop_bottom_len;
+
+	/*
+	 * Consumers only interested in a part of the picture read just that.
+	 * Without a window the full frame is set, the driver keeps the one
+	 * of an earlier sequence otherwise.
+	 */
+	struct v4l2_crop roi = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.c = { 0, 0, width, height },
+	};
+	gboolean has_roi = vpu_dec->roi.width && vpu_dec->roi.height;
+
+	if (has_roi)
+		roi.c = vpu_dec->roi;
+	if (ioctl(vpu_dec->vpu_fd, VIDIOC_S_CROP, &roi) && has_roi)
+		GST_WARNING_OBJECT(vpu_dec, "VIDIOC_S_CROP failed: %s",
+				strerror(errno));
+
+	/*
+	 * The pictures are padded to full macroblocks, the driver knows
+	 * which part is visible, e.g. 1920x1080 of 1920x1088 for H.264,
+	 * narrowed down to the window of interest.
+	 */
+	if (ioctl(vpu_dec->vpu_fd, VIDIOC_G_CROP, &crop) == 0 &&
+			crop.c.width > 0 && crop.c.height > 0 &&
+			crop.c.left + crop.c.width <= width &&
+			crop.c.top + crop.c.height <= height) {
+		crop_top_len = crop.c.top;
+		crop_left_len = crop.c.left;
+		crop_right_len = width - crop.c.left - crop.c.width;
+		crop_bottom_len = height - crop.c.top - crop.c.height;
+	} else {
+		/* older drivers only report the coded size */
+		crop_top_len = 0;
+		crop_left_len = 0;
+		crop_right_len = width - orgPicW;
+		crop_bottom_len = height - orgPicH;
+	}
+
+	/*
+	 * Pictures between the ones output are decoded as references only,
+	 * the VPU doesn't write them to a capture buffer.
+	 */
+	vpu_dec->interval_state = 1;
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_OUTPUT_INTERVAL,
+				vpu_dec->output_interval))
+		GST_WARNING_OBJECT(vpu_dec, "VPU_IOC_OUTPUT_INTERVAL failed: %s",
+				strerror(errno));
+	else
+		vpu_dec->interval_state = vpu_dec->output_interval;
+
+	GST_DEBUG_OBJECT(vpu_dec, "visible %dx%d at %d,%d",
+			width - crop_left_len - crop_right_len,
+			height - crop_top_len - crop_bottom_len,
+			crop_left_len, crop_top_len);
+
+	vpu_dec->outsize = fmt.fmt.pix.sizeimage;
+
+	/* the whole canvas is pushed instead of the picture */
+	if (vpu_dec->canvas_name) {
+		width = vpu_dec->canvas_geom.width;
+		height = vpu_dec->canvas_geom.height;
+		crop_top_len = crop_left_len = 0;
+		crop_right_len = crop_bottom_len = 0;
+		vpu_dec->outsize = width * height * 3 / 2;
+	}
 
 	/* set the capabilites on the source pad */
 	caps = gst_caps_new_simple("video/x-raw-yuv",
@@ -473,19 +1630,21 @@ static GstFlowReturn mfw_gst_vpudec_vpu_init(GstVPU_Dec * vpu_dec)
 			"height", G_TYPE_INT, height,
 			"pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
 			"crop-top-by-pixel", G_TYPE_INT, crop_top_len,
-			"crop-left-by-pixel", G_TYPE_INT, (crop_left_len + 7) / 8 * 8,
-			"crop-right-by-pixel", G_TYPE_INT, crop_right_by_pixel,
-			"crop-bottom-by-pixel", G_TYPE_INT, crop_bottom_by_pixel,
-			"framerate", GST_TYPE_FRACTION, vpu_dec->frame_rate_nu, vpu_dec->frame_rate_de,
+			"crop-left-by-pixel", G_TYPE_INT, crop_left_len,
+			"crop-right-by-pixel", G_TYPE_INT, crop_right_len,
+			"crop-bottom-by-pixel", G_TYPE_INT, crop_bottom_len,
+			"framerate", GST_TYPE_FRACTION, vpu_dec->frame_rate_nu,
+			vpu_dec->frame_rate_de * vpu_dec->interval_state,
 			NULL);
+	if (vpu_dec->export_dmabuf)
+		gst_caps_set_simple(caps, MFW_GST_VPUDEC_DMABUF_FIELD,
+				G_TYPE_BOOLEAN, TRUE, NULL);
 
 	if (!(gst_pad_set_caps(vpu_dec->srcpad, caps)))
 		GST_ERROR("Could not set the caps for the VPU decoder's src pad");
 	gst_caps_unref(caps);
 
-	vpu_dec->outsize = (vpu_dec->width * vpu_dec->height * 3) / 2;
-
-	retval = mfw_gst_vpudec_reqbufs(vpu_dec);
+	retval = mfw_gst_vpudec_reqbufs(vpu_dec, fourcc);
 	if (retval) {
 		GST_ERROR("requesting buffers failed: %s\n", strerror(errno));
 		return -errno;
@@ -497,149 +1656,2040 @@ static GstFlowReturn mfw_gst_vpudec_vpu_init(GstVPU_Dec * vpu_dec)
 		return -errno;
 	}
 
-	vpu_dec->init = TRUE;
+	vpu_dec->init = TRUE;
+
+	return 0;
+}
+
+/*
+ * Attach the timestamp to the bitstream written next. The VPU driver
+ * hands it back with the picture decoded from that data.
+ */
+static void mfw_gst_vpudec_set_timestamp(GstVPU_Dec *vpu_dec,
+		GstClockTime timestamp, GstClockTime duration)
+{
+	struct timeval tv;
+
+	GST_TIME_TO_TIMEVAL(timestamp, tv);
+
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_PTS, &tv)) {
+		GST_WARNING_OBJECT(vpu_dec, "VPU_IOC_PTS failed: %s", strerror(errno));
+		return;
+	}
+
+	GST_OBJECT_LOCK(vpu_dec);
+	vpu_dec->has_pts = TRUE;
+	vpu_dec->in_ts[vpu_dec->in_idx] = timestamp;
+	vpu_dec->in_duration[vpu_dec->in_idx] = duration;
+	vpu_dec->in_idx = (vpu_dec->in_idx + 1) % MAX_TIMESTAMPS;
+	GST_OBJECT_UNLOCK(vpu_dec);
+}
+
+/* Forget the timestamps written, the VPU has dropped their bitstream */
+static void mfw_gst_vpudec_clear_timestamps(GstVPU_Dec *vpu_dec)
+{
+	int i;
+
+	GST_OBJECT_LOCK(vpu_dec);
+	for (i = 0; i < MAX_TIMESTAMPS; i++)
+		vpu_dec->in_ts[i] = GST_CLOCK_TIME_NONE;
+	vpu_dec->in_idx = 0;
+	GST_OBJECT_UNLOCK(vpu_dec);
+}
+
+static GstClockTime mfw_gst_vpudec_get_duration(GstVPU_Dec *vpu_dec,
+		GstClockTime timestamp)
+{
+	GstClockTime duration = GST_CLOCK_TIME_NONE;
+	int i;
+
+	GST_OBJECT_LOCK(vpu_dec);
+	for (i = 0; i < MAX_TIMESTAMPS; i++) {
+		if (vpu_dec->in_ts[i] == timestamp) {
+			duration = vpu_dec->in_duration[i];
+			break;
+		}
+	}
+	GST_OBJECT_UNLOCK(vpu_dec);
+
+	if (!GST_CLOCK_TIME_IS_VALID(duration) && vpu_dec->frame_rate_nu > 0)
+		duration = gst_util_uint64_scale(GST_SECOND,
+				vpu_dec->frame_rate_de, vpu_dec->frame_rate_nu);
+
+	/* an output picture stands for the ones dropped after it */
+	if (GST_CLOCK_TIME_IS_VALID(duration))
+		duration *= vpu_dec->interval_state;
+
+	return duration;
+}
+
+/*
+ * The capture queue set up from our sequence header doesn't fit the
+ * stream if the VPU reports another picture size. Nothing has been
+ * decoded into it yet, set it up again for the size the VPU found.
+ * Returns whether that was necessary.
+ */
+static gboolean mfw_gst_vpudec_hint_failed(GstVPU_Dec *vpu_dec)
+{
+	unsigned long type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	struct v4l2_format fmt = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+	};
+
+	if (ioctl(vpu_dec->vpu_fd, VIDIOC_G_FMT, &fmt) ||
+			(fmt.fmt.pix.width == vpu_dec->width &&
+			 fmt.fmt.pix.height == vpu_dec->height))
+		return FALSE;
+
+	GST_INFO_OBJECT(vpu_dec, "stream is %dx%d, the sequence header parsed "
+			"said %dx%d", fmt.fmt.pix.width, fmt.fmt.pix.height,
+			vpu_dec->width, vpu_dec->height);
+
+	if (ioctl(vpu_dec->vpu_fd, VIDIOC_STREAMOFF, &type))
+		GST_WARNING_OBJECT(vpu_dec, "streamoff failed: %s", strerror(errno));
+
+	mfw_gst_vpudec_buffers_unref(vpu_dec);
+
+	if (mfw_gst_vpudec_vpu_init(vpu_dec)) {
+		GST_ELEMENT_ERROR(vpu_dec, STREAM, DECODE, (NULL),
+				("setting up the decoder for %dx%d failed",
+				 fmt.fmt.pix.width, fmt.fmt.pix.height));
+		vpu_dec->output_flow = GST_FLOW_ERROR;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Dequeue one decoded picture. Returns -EAGAIN when no picture is ready
+ * and -EPIPE once the decoder has been drained after EOS.
+ */
+static int vpu_dec_dqbuf(GstVPU_Dec *vpu_dec, struct v4l2_buffer *v4l2_buf)
+{
+	int ret;
+
+	ret = ioctl(vpu_dec->vpu_fd, VIDIOC_DQBUF, v4l2_buf);
+	if (ret)
+		return -errno;
+
+	/* The VPU returns empty buffers while it is draining */
+	while (v4l2_buf->flags & V4L2_BUF_FLAG_ERROR) {
+		if (vpu_dec->eos || vpu_dec->draining)
+			return -EPIPE;
+
+		if (mfw_gst_vpudec_hint_failed(vpu_dec))
+			return vpu_dec->output_flow == GST_FLOW_OK ?
+				-EAGAIN : -EIO;
+
+		ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, v4l2_buf);
+		if (ret)
+			return -errno;
+
+		ret = ioctl(vpu_dec->vpu_fd, VIDIOC_DQBUF, v4l2_buf);
+		if (ret)
+			return -errno;
+	}
+
+	return 0;
+}
+
+static GstClockTime vpu_dec_get_timestamp(GstVPU_Dec *vpu_dec,
+		struct v4l2_buffer *v4l2_buf)
+{
+	/* Without input timestamps update the time stamp based on the frame-rate */
+	if (vpu_dec->has_pts)
+		return GST_TIMEVAL_TO_TIME(v4l2_buf->timestamp);
+
+	return gst_util_uint64_scale(vpu_dec->decoded_frames *
+			vpu_dec->interval_state,
+			vpu_dec->frame_rate_de * GST_SECOND,
+			vpu_dec->frame_rate_nu);
+}
+
+/* Dequeue one decoded picture as a buffer to push downstream */
+static int vpu_dec_dequeue(GstVPU_Dec *vpu_dec, GstBuffer **outbuf)
+{
+	GstBuffer *pushbuff;
+	gboolean zerocopy = FALSE;
+	int ret;
+	struct v4l2_buffer v4l2_buf = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+	};
+
+	ret = vpu_dec_dqbuf(vpu_dec, &v4l2_buf);
+	if (ret)
+		return ret;
+
+	/*
+	 * Hand out the capture buffer itself as long as this leaves the VPU
+	 * with at least one buffer to decode into. Otherwise fall back to
+	 * copying so that downstream holding on to buffers cannot stall the
+	 * decoder.
+	 */
+	g_mutex_lock(vpu_dec->buf_lock);
+	if (vpu_dec->buf_outstanding + 1 < vpu_dec->num_buffers) {
+		pushbuff = mfw_gst_vpudec_buffer_new(vpu_dec, v4l2_buf.index);
+		zerocopy = TRUE;
+		vpu_dec->pool_hits++;
+	} else {
+		vpu_dec->pool_misses++;
+	}
+	g_mutex_unlock(vpu_dec->buf_lock);
+
+	if (zerocopy)
+		ret = GST_FLOW_OK;
+	else
+		ret = gst_pad_alloc_buffer_and_set_caps(vpu_dec->srcpad, 0,
+				      vpu_dec->outsize,
+				      GST_PAD_CAPS(vpu_dec->srcpad),
+				      &pushbuff);
+
+	if (ret != GST_FLOW_OK) {
+		GST_DEBUG_OBJECT(vpu_dec, "Allocating the Framebuffer[%d] failed with %d",
+		     0, ret);
+		vpu_dec->output_flow = ret;
+		return -ENOMEM;
+	}
+
+	if (!zerocopy)
+		memcpy(GST_BUFFER_DATA(pushbuff), vpu_dec->buf_data[v4l2_buf.index], vpu_dec->outsize);
+
+	/* zerocopy buffers are queued again once downstream releases them */
+	if (!zerocopy) {
+		ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &v4l2_buf);
+		if (ret) {
+			GST_DEBUG_OBJECT(vpu_dec, "Decoder qbuf failed?? error: %d\n", errno);
+			gst_buffer_unref(pushbuff);
+			vpu_dec->output_flow = GST_FLOW_ERROR;
+			return -errno;
+		}
+	}
+
+	GST_BUFFER_SIZE(pushbuff) = vpu_dec->outsize;
+
+	GST_BUFFER_TIMESTAMP(pushbuff) = vpu_dec_get_timestamp(vpu_dec, &v4l2_buf);
+	GST_BUFFER_DURATION(pushbuff) = mfw_gst_vpudec_get_duration(vpu_dec,
+			GST_BUFFER_TIMESTAMP(pushbuff));
+
+	vpu_dec->decoded_frames++;
+
+	GST_DEBUG_OBJECT(vpu_dec, "frame decoded : %lld ts = %" GST_TIME_FORMAT,
+			vpu_dec->decoded_frames,
+			GST_TIME_ARGS(GST_BUFFER_TIMESTAMP(pushbuff)));
+
+	*outbuf = pushbuff;
+
+	return 0;
+}
+
+/*
+ * Wait for the running time of a picture rendered into the framebuffer.
+ * Like a sink the first picture is shown right away and the others are
+ * held while paused. Returns GST_CLOCK_UNSCHEDULED when flushing and
+ * GST_CLOCK_EARLY for pictures late by more than their duration.
+ */
+static GstClockReturn mfw_gst_vpudec_wait_clock(GstVPU_Dec *vpu_dec,
+		GstClockTime timestamp)
+{
+	GstClockTime running;
+	GstClockTimeDiff jitter;
+	GstClockReturn ret;
+	GstClockID id;
+	GstClock *clock;
+
+	GST_OBJECT_LOCK(vpu_dec);
+	running = gst_segment_to_running_time(&vpu_dec->segment,
+			GST_FORMAT_TIME, timestamp);
+	GST_OBJECT_UNLOCK(vpu_dec);
+
+	for (;;) {
+		id = NULL;
+
+		g_mutex_lock(vpu_dec->buf_lock);
+		while (!vpu_dec->flushing && vpu_dec->fb_shown >= 0 &&
+				vpu_dec->state != GST_STATE_PLAYING)
+			g_cond_wait(vpu_dec->drain_cond, vpu_dec->buf_lock);
+
+		if (vpu_dec->flushing) {
+			g_mutex_unlock(vpu_dec->buf_lock);
+			return GST_CLOCK_UNSCHEDULED;
+		}
+
+		clock = gst_element_get_clock(GST_ELEMENT(vpu_dec));
+		if (clock && GST_CLOCK_TIME_IS_VALID(running) &&
+				vpu_dec->state == GST_STATE_PLAYING) {
+			id = gst_clock_new_single_shot_id(clock, running +
+					gst_element_get_base_time(GST_ELEMENT(vpu_dec)));
+			vpu_dec->clock_id = id;
+		}
+		g_mutex_unlock(vpu_dec->buf_lock);
+
+		if (clock)
+			gst_object_unref(clock);
+		if (!id)
+			return GST_CLOCK_OK;
+
+		ret = gst_clock_id_wait(id, &jitter);
+
+		g_mutex_lock(vpu_dec->buf_lock);
+		vpu_dec->clock_id = NULL;
+		g_mutex_unlock(vpu_dec->buf_lock);
+		gst_clock_id_unref(id);
+
+		/* unscheduled by pausing, wait again once playing */
+		if (ret != GST_CLOCK_UNSCHEDULED)
+			break;
+	}
+
+	if (ret == GST_CLOCK_EARLY &&
+			jitter < mfw_gst_vpudec_get_duration(vpu_dec, timestamp))
+		ret = GST_CLOCK_OK;
+
+	return ret;
+}
+
+/*
+ * Show all pictures the VPU has finished when decoding into the overlay
+ * framebuffer. The page shown before is queued again once the display
+ * has switched to the new one.
+ */
+static int vpu_dec_show_frames(GstVPU_Dec *vpu_dec)
+{
+	GstClockTime timestamp;
+	GstClockReturn wait;
+	int ret;
+	struct v4l2_buffer v4l2_buf = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+	};
+
+	while (!(ret = vpu_dec_dqbuf(vpu_dec, &v4l2_buf))) {
+		timestamp = vpu_dec_get_timestamp(vpu_dec, &v4l2_buf);
+		vpu_dec->decoded_frames++;
+
+		wait = mfw_gst_vpudec_wait_clock(vpu_dec, timestamp);
+		if (wait == GST_CLOCK_UNSCHEDULED) {
+			/* flushing, requeued like the pictures not shown yet */
+			ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &v4l2_buf);
+			vpu_dec->output_flow = GST_FLOW_WRONG_STATE;
+			return -EPIPE;
+		}
+
+		if (wait == GST_CLOCK_EARLY) {
+			GST_DEBUG_OBJECT(vpu_dec, "dropping late picture %" GST_TIME_FORMAT,
+					GST_TIME_ARGS(timestamp));
+			ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &v4l2_buf);
+			if (ret)
+				return -errno;
+			continue;
+		}
+
+		if (!mfw_gst_vpu_fb_flip(vpu_dec->fb, v4l2_buf.index)) {
+			GST_ERROR_OBJECT(vpu_dec, "panning %s failed: %s",
+					vpu_dec->fb_device, strerror(errno));
+			vpu_dec->output_flow = GST_FLOW_ERROR;
+			return -EIO;
+		}
+
+		GST_DEBUG_OBJECT(vpu_dec, "frame shown : %lld ts = %" GST_TIME_FORMAT,
+				vpu_dec->decoded_frames, GST_TIME_ARGS(timestamp));
+
+		if (vpu_dec->fb_shown >= 0) {
+			ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF,
+					&vpu_dec->buf_v4l2[vpu_dec->fb_shown]);
+			if (ret)
+				return -errno;
+		}
+		vpu_dec->fb_shown = v4l2_buf.index;
+	}
+
+	return ret;
+}
+
+/*
+ * Canvas mode: the VPU has written a picture to our tile of the back
+ * canvas. The tile is done, nothing is queued until the next swap.
+ */
+static int vpu_dec_compose_frames(GstVPU_Dec *vpu_dec)
+{
+	GstVPUDecCanvas *canvas = vpu_dec->canvas;
+	int ret;
+	struct v4l2_buffer v4l2_buf = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+	};
+
+	while (!(ret = vpu_dec_dqbuf(vpu_dec, &v4l2_buf))) {
+		vpu_dec->canvas_ts = vpu_dec_get_timestamp(vpu_dec, &v4l2_buf);
+		vpu_dec->decoded_frames++;
+
+		g_static_mutex_lock(&mfw_gst_vpudec_canvas_lock);
+		vpu_dec->canvas_queued = -1;
+		if (vpu_dec->canvas_active)
+			canvas->finished |= vpu_dec->canvas_tile;
+		g_static_mutex_unlock(&mfw_gst_vpudec_canvas_lock);
+	}
+
+	/* drained, the buffer came back empty */
+	if (ret == -EPIPE) {
+		g_static_mutex_lock(&mfw_gst_vpudec_canvas_lock);
+		vpu_dec->canvas_queued = -1;
+		g_static_mutex_unlock(&mfw_gst_vpudec_canvas_lock);
+	}
+
+	return ret;
+}
+
+/*
+ * The back canvas has all tiles, make it the front one and let the VPUs
+ * write to the other. With the canvas lock held.
+ */
+static void mfw_gst_vpudec_canvas_swap(GstVPUDecCanvas *canvas)
+{
+	GSList *l;
+
+	canvas->back ^= 1;
+	canvas->finished = 0;
+
+	for (l = canvas->decoders; l; l = l->next) {
+		GstVPU_Dec *dec = l->data;
+
+		if (dec->canvas_active)
+			mfw_gst_vpudec_canvas_queue(dec);
+	}
+}
+
+/*
+ * Canvas mode: on each display tick the owner swaps in the back canvas
+ * if all tiles are done and pushes it. Ticks follow the frame rate on
+ * the pipeline clock. Without a running clock, as while prerolling, the
+ * canvas goes out as soon as it is complete. Sets the poll timeout in
+ * ms until the next tick, the other decoders look for a vacant owner
+ * just as often.
+ */
+static GstFlowReturn mfw_gst_vpudec_canvas_tick(GstVPU_Dec *vpu_dec,
+		gint *timeout)
+{
+	GstVPUDecCanvas *canvas = vpu_dec->canvas;
+	GstClockTime interval = GST_CLOCK_TIME_NONE;
+	GstClockTime now = GST_CLOCK_TIME_NONE;
+	GstClockTime timestamp;
+	GstBuffer *pushbuff = NULL;
+	GstFlowReturn flow;
+	GstClock *clock;
+
+	if (vpu_dec->frame_rate_nu > 0 && vpu_dec->frame_rate_de > 0)
+		interval = gst_util_uint64_scale(GST_SECOND,
+				vpu_dec->frame_rate_de * vpu_dec->interval_state,
+				vpu_dec->frame_rate_nu);
+	*timeout = GST_CLOCK_TIME_IS_VALID(interval) ?
+		GST_TIME_AS_MSECONDS(interval) + 1 : CANVAS_POLL_MS;
+
+	GST_OBJECT_LOCK(vpu_dec);
+	clock = GST_ELEMENT_CLOCK(vpu_dec);
+	if (clock && GST_STATE(vpu_dec) == GST_STATE_PLAYING &&
+			GST_CLOCK_TIME_IS_VALID(interval))
+		now = gst_clock_get_time(clock) -
+			GST_ELEMENT_CAST(vpu_dec)->base_time;
+	GST_OBJECT_UNLOCK(vpu_dec);
+
+	g_static_mutex_lock(&mfw_gst_vpudec_canvas_lock);
+
+	if (!canvas->owner && vpu_dec->canvas_active)
+		canvas->owner = vpu_dec;
+	if (canvas->owner != vpu_dec)
+		goto out;
+
+	if (GST_CLOCK_TIME_IS_VALID(now)) {
+		/* start ticking, or again after falling behind */
+		if (!GST_CLOCK_TIME_IS_VALID(canvas->next_tick) ||
+				now >= canvas->next_tick + interval)
+			canvas->next_tick = now;
+		if (now < canvas->next_tick) {
+			*timeout = GST_TIME_AS_MSECONDS(canvas->next_tick - now) + 1;
+			goto out;
+		}
+		timestamp = canvas->next_tick;
+		canvas->next_tick += interval;
+		*timeout = GST_TIME_AS_MSECONDS(canvas->next_tick - now) + 1;
+	}
+
+	/* the tick passes without a new canvas */
+	if (!canvas->members || canvas->finished != canvas->members)
+		goto out;
+
+	mfw_gst_vpudec_canvas_swap(canvas);
+	pushbuff = gst_buffer_create_sub(canvas->buffer[canvas->back ^ 1], 0,
+			vpu_dec->outsize);
+out:
+	g_static_mutex_unlock(&mfw_gst_vpudec_canvas_lock);
+
+	if (!pushbuff)
+		return GST_FLOW_OK;
+
+	if (GST_CLOCK_TIME_IS_VALID(now)) {
+		/* the stream time of the tick */
+		GST_OBJECT_LOCK(vpu_dec);
+		if (timestamp >= vpu_dec->segment.accum)
+			timestamp += vpu_dec->segment.start -
+				vpu_dec->segment.accum;
+		GST_OBJECT_UNLOCK(vpu_dec);
+		GST_BUFFER_DURATION(pushbuff) = interval;
+	} else {
+		timestamp = vpu_dec->canvas_ts;
+		GST_BUFFER_DURATION(pushbuff) =
+			mfw_gst_vpudec_get_duration(vpu_dec, timestamp);
+	}
+
+	gst_buffer_set_caps(pushbuff, GST_PAD_CAPS(vpu_dec->srcpad));
+	GST_BUFFER_TIMESTAMP(pushbuff) = timestamp;
+
+	flow = gst_pad_push(vpu_dec->srcpad, pushbuff);
+	if (flow != GST_FLOW_OK)
+		GST_DEBUG_OBJECT(vpu_dec, "Pushing the canvas failed with %s",
+				gst_flow_get_name(flow));
+
+	return flow;
+}
+
+static gboolean mfw_gst_vpudec_reverse(GstVPU_Dec *vpu_dec)
+{
+	gboolean reverse;
+
+	GST_OBJECT_LOCK(vpu_dec);
+	reverse = vpu_dec->segment.rate < 0.0;
+	GST_OBJECT_UNLOCK(vpu_dec);
+
+	return reverse;
+}
+
+/*
+ * Keep a picture in the frame cache. Capture buffers have to go back to
+ * the VPU, so the cache holds a copy of those.
+ */
+static void mfw_gst_vpudec_cache_frame(GstVPU_Dec *vpu_dec, GstBuffer *buf,
+		gboolean reverse)
+{
+	GstBuffer *frame;
+	guint dropped;
+
+	if (G_TYPE_CHECK_INSTANCE_TYPE(buf, MFW_GST_TYPE_VPUDEC_BUFFER))
+		frame = gst_buffer_copy(buf);
+	else
+		frame = gst_buffer_ref(buf);
+
+	GST_OBJECT_LOCK(vpu_dec);
+	vpu_dec->cache.budget = vpu_dec->frame_cache_size;
+	if (reverse && !vpu_dec->cache.budget)
+		vpu_dec->cache.budget = REVERSE_CACHE_SIZE;
+	dropped = mfw_gst_vpu_cache_add(&vpu_dec->cache, frame);
+	GST_OBJECT_UNLOCK(vpu_dec);
+
+	if (reverse && dropped)
+		GST_WARNING_OBJECT(vpu_dec, "GOP exceeds the frame cache, "
+				"%u pictures won't be played", dropped);
+}
+
+/*
+ * Push the pictures of a GOP decoded at a negative rate, newest first.
+ * Called by the output task at EOS or with the task paused.
+ */
+static GstFlowReturn mfw_gst_vpudec_push_reverse(GstVPU_Dec *vpu_dec)
+{
+	GstFlowReturn flow = GST_FLOW_OK;
+	GstBuffer *frame;
+	gboolean discont = TRUE;
+
+	for (;;) {
+		GST_OBJECT_LOCK(vpu_dec);
+		frame = mfw_gst_vpu_cache_pop_newest(&vpu_dec->cache);
+		GST_OBJECT_UNLOCK(vpu_dec);
+		if (!frame)
+			break;
+
+		if (flow != GST_FLOW_OK) {
+			gst_buffer_unref(frame);
+			continue;
+		}
+
+		if (discont) {
+			frame = gst_buffer_make_metadata_writable(frame);
+			GST_BUFFER_FLAG_SET(frame, GST_BUFFER_FLAG_DISCONT);
+			discont = FALSE;
+		}
+
+		flow = gst_pad_push(vpu_dec->srcpad, frame);
+	}
+
+	if (flow != GST_FLOW_OK)
+		GST_DEBUG_OBJECT(vpu_dec, "Pushing the reversed GOP failed with %s",
+				gst_flow_get_name(flow));
+
+	return flow;
+}
+
+/* Push the cached pictures a seek has been served from */
+static int vpu_dec_replay_frames(GstVPU_Dec *vpu_dec)
+{
+	GstFlowReturn flow = GST_FLOW_OK;
+	GstBuffer *frame;
+
+	while (vpu_dec->replay) {
+		frame = vpu_dec->replay->data;
+		vpu_dec->replay = g_list_delete_link(vpu_dec->replay,
+				vpu_dec->replay);
+
+		if (flow == GST_FLOW_OK)
+			flow = gst_pad_push(vpu_dec->srcpad, frame);
+		else
+			gst_buffer_unref(frame);
+	}
+
+	if (flow != GST_FLOW_OK) {
+		GST_DEBUG_OBJECT(vpu_dec, "Pushing cached pictures failed with %s",
+				gst_flow_get_name(flow));
+		vpu_dec->output_flow = flow;
+		return -EPIPE;
+	}
+
+	return 0;
+}
+
+static void mfw_gst_vpudec_clear_cache(GstVPU_Dec *vpu_dec)
+{
+	g_list_foreach(vpu_dec->replay, (GFunc) gst_mini_object_unref, NULL);
+	g_list_free(vpu_dec->replay);
+	vpu_dec->replay = NULL;
+
+	GST_OBJECT_LOCK(vpu_dec);
+	mfw_gst_vpu_cache_clear(&vpu_dec->cache);
+	GST_OBJECT_UNLOCK(vpu_dec);
+}
+
+/*
+ * Push all pictures the VPU has finished, either one by one or, with
+ * push-list set, as a single buffer list. At a negative rate they are
+ * collected in the frame cache instead, to be pushed in reverse once
+ * the GOP is complete.
+ */
+static int vpu_dec_push_frames(GstVPU_Dec *vpu_dec)
+{
+	GstBufferList *list = NULL;
+	GstBufferListIterator *it = NULL;
+	GstBuffer *pushbuff;
+	GstFlowReturn flow = GST_FLOW_OK;
+	gboolean reverse = mfw_gst_vpudec_reverse(vpu_dec);
+	int ret;
+
+	while (!(ret = vpu_dec_dequeue(vpu_dec, &pushbuff))) {
+		if (reverse || vpu_dec->frame_cache_size)
+			mfw_gst_vpudec_cache_frame(vpu_dec, pushbuff, reverse);
+
+		if (reverse) {
+			gst_buffer_unref(pushbuff);
+			continue;
+		}
+
+		if (!vpu_dec->push_list) {
+			flow = gst_pad_push(vpu_dec->srcpad, pushbuff);
+			if (flow != GST_FLOW_OK)
+				break;
+			continue;
+		}
+
+		if (!list) {
+			list = gst_buffer_list_new();
+			it = gst_buffer_list_iterate(list);
+		}
+		gst_buffer_list_iterator_add_group(it);
+		gst_buffer_list_iterator_add(it, pushbuff);
+	}
+
+	if (list) {
+		gst_buffer_list_iterator_free(it);
+		flow = gst_pad_push_list(vpu_dec->srcpad, list);
+	}
+
+	if (flow != GST_FLOW_OK) {
+		GST_DEBUG_OBJECT(vpu_dec, "Pushing the Output onto the Source Pad failed with %s",
+				gst_flow_get_name(flow));
+		vpu_dec->output_flow = flow;
+		return -EPIPE;
+	}
+
+	return ret;
+}
+
+/* Unblocks the streaming thread and the output task while flushing */
+static void mfw_gst_vpudec_set_flushing(GstVPU_Dec *vpu_dec, gboolean flushing)
+{
+	char c = 0;
+
+	/* called from the streaming thread, the output task and the app */
+	g_mutex_lock(vpu_dec->buf_lock);
+	if (vpu_dec->flushing == flushing) {
+		g_mutex_unlock(vpu_dec->buf_lock);
+		return;
+	}
+
+	vpu_dec->flushing = flushing;
+	g_cond_broadcast(vpu_dec->drain_cond);
+	if (flushing && vpu_dec->clock_id)
+		gst_clock_id_unschedule(vpu_dec->clock_id);
+
+	/* the pipe stays readable for as long as we are flushing */
+	if (flushing)
+		write(vpu_dec->wakeup_fd[1], &c, 1);
+	else
+		read(vpu_dec->wakeup_fd[0], &c, 1);
+	g_mutex_unlock(vpu_dec->buf_lock);
+}
+
+static void mfw_gst_vpudec_output_loop(GstVPU_Dec *vpu_dec)
+{
+	struct pollfd pollfd[2];
+	gint timeout = -1;
+	int ret;
+
+	pollfd[0].fd = vpu_dec->vpu_fd;
+	pollfd[0].events = POLLIN;
+	pollfd[1].fd = vpu_dec->wakeup_fd[0];
+	pollfd[1].events = POLLIN;
+
+	/* pictures from the frame cache go out before newly decoded ones */
+	if (vpu_dec->replay && vpu_dec_replay_frames(vpu_dec))
+		goto pause;
+
+	if (vpu_dec->canvas) {
+		vpu_dec->output_flow = mfw_gst_vpudec_canvas_tick(vpu_dec,
+				&timeout);
+		if (vpu_dec->output_flow != GST_FLOW_OK)
+			goto pause;
+	}
+
+	ret = poll(pollfd, 2, timeout);
+	if (ret < 0) {
+		if (errno == EINTR)
+			return;
+		vpu_dec->output_flow = GST_FLOW_ERROR;
+		goto pause;
+	}
+
+	if (pollfd[1].revents & POLLIN) {
+		vpu_dec->output_flow = GST_FLOW_WRONG_STATE;
+		goto pause;
+	}
+
+	if (pollfd[0].revents & POLLIN) {
+		if (vpu_dec->canvas)
+			ret = vpu_dec_compose_frames(vpu_dec);
+		else if (vpu_dec->fb)
+			ret = vpu_dec_show_frames(vpu_dec);
+		else
+			ret = vpu_dec_push_frames(vpu_dec);
+		if (ret && ret != -EAGAIN) {
+			if (ret != -EPIPE && vpu_dec->output_flow == GST_FLOW_OK)
+				vpu_dec->output_flow = GST_FLOW_ERROR;
+			goto pause;
+		}
+		return;
+	}
+
+	if (pollfd[0].revents & POLLERR) {
+		GST_DEBUG_OBJECT(vpu_dec, "POLLERR\n");
+		vpu_dec->output_flow = GST_FLOW_ERROR;
+		goto pause;
+	}
+
+	return;
+
+pause:
+	GST_DEBUG_OBJECT(vpu_dec, "pausing output task: %s",
+			gst_flow_get_name(vpu_dec->output_flow));
+
+	if (vpu_dec->output_flow == GST_FLOW_OK && vpu_dec->draining) {
+		/* the streaming thread sets up the new sequence */
+		g_mutex_lock(vpu_dec->buf_lock);
+		vpu_dec->draining = FALSE;
+		g_cond_broadcast(vpu_dec->drain_cond);
+		g_mutex_unlock(vpu_dec->buf_lock);
+		gst_pad_pause_task(vpu_dec->srcpad);
+		return;
+	}
+
+	if (vpu_dec->output_flow == GST_FLOW_OK && vpu_dec->eos) {
+		/* all pictures are out */
+		mfw_gst_vpudec_canvas_retire(vpu_dec);
+		if (mfw_gst_vpudec_reverse(vpu_dec))
+			mfw_gst_vpudec_push_reverse(vpu_dec);
+		vpu_dec->output_flow = GST_FLOW_UNEXPECTED;
+		gst_pad_push_event(vpu_dec->srcpad, gst_event_new_eos());
+		if (GST_OBJECT_FLAG_IS_SET(vpu_dec, GST_ELEMENT_IS_SINK))
+			gst_element_post_message(GST_ELEMENT(vpu_dec),
+					gst_message_new_eos(GST_OBJECT(vpu_dec)));
+		gst_pad_pause_task(vpu_dec->srcpad);
+		return;
+	}
+
+	if (vpu_dec->output_flow < GST_FLOW_UNEXPECTED ||
+			vpu_dec->output_flow == GST_FLOW_NOT_LINKED) {
+		GST_ELEMENT_ERROR(vpu_dec, STREAM, FAILED, (NULL),
+				("output task failed: %s",
+				 gst_flow_get_name(vpu_dec->output_flow)));
+		gst_pad_push_event(vpu_dec->srcpad, gst_event_new_eos());
+	}
+
+	/* don't leave the streaming thread waiting for bitstream space */
+	if (vpu_dec->output_flow != GST_FLOW_WRONG_STATE)
+		mfw_gst_vpudec_set_flushing(vpu_dec, TRUE);
+
+	gst_pad_pause_task(vpu_dec->srcpad);
+}
+
+/*
+ * Discard the bitstream and all decoded pictures not pushed yet. The
+ * output task must not be running.
+ */
+static void mfw_gst_vpudec_flush(GstVPU_Dec *vpu_dec)
+{
+	struct v4l2_buffer v4l2_buf = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = vpu_dec->streamtype,
+	};
+
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_FLUSH))
+		GST_WARNING_OBJECT(vpu_dec, "VPU_IOC_FLUSH failed: %s", strerror(errno));
+	mfw_gst_vpudec_clear_timestamps(vpu_dec);
+	/* the driver stops skipping as well */
+	vpu_dec->skip_state = 0;
+
+	if (!vpu_dec->init)
+		return;
+
+	while (!ioctl(vpu_dec->vpu_fd, VIDIOC_DQBUF, &v4l2_buf)) {
+		if (ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &v4l2_buf))
+			GST_WARNING_OBJECT(vpu_dec, "requeueing buffer %d failed: %s",
+					v4l2_buf.index, strerror(errno));
+	}
+}
+
+static void mfw_gst_vpudec_start_output(GstVPU_Dec *vpu_dec)
+{
+	vpu_dec->output_flow = GST_FLOW_OK;
+	mfw_gst_vpudec_canvas_activate(vpu_dec);
+
+	gst_pad_start_task(vpu_dec->srcpad,
+			(GstTaskFunction) mfw_gst_vpudec_output_loop, vpu_dec);
+}
+
+static gboolean
+mfw_gst_vpudec_src_activate_push(GstPad * pad, gboolean active)
+{
+	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(GST_PAD_PARENT(pad));
+
+	if (active)
+		return TRUE;
+
+	/* the output task is started once the VPU has been initialised */
+	mfw_gst_vpudec_set_flushing(vpu_dec, TRUE);
+
+	return gst_pad_stop_task(pad);
+}
+
+/*
+ * A seek served from the frame cache flushes the output task only. The
+ * streaming thread waits for it to finish instead of returning. Returns
+ * whether we are still flushing after that.
+ */
+static gboolean mfw_gst_vpudec_wait_cache_seek(GstVPU_Dec *vpu_dec)
+{
+	gboolean flushing;
+
+	g_mutex_lock(vpu_dec->buf_lock);
+	while (vpu_dec->cache_seek)
+		g_cond_wait(vpu_dec->drain_cond, vpu_dec->buf_lock);
+	flushing = vpu_dec->flushing;
+	g_mutex_unlock(vpu_dec->buf_lock);
+
+	return flushing;
+}
+
+/*
+ * Write bitstream data to the VPU, waiting for space in its bitstream
+ * buffer as needed. Several pieces are written with a single VPU_IOC_WRITEV
+ * each time there is space. The iovecs are updated with the progress.
+ */
+static GstFlowReturn
+mfw_gst_vpudec_writev(GstVPU_Dec *vpu_dec, struct iovec *iov, guint count)
+{
+	int ret = 0;
+	GstFlowReturn retval = GST_FLOW_OK;
+	struct vpu_writev wv;
+	struct pollfd pollfd[2];
+
+	pollfd[0].fd = vpu_dec->vpu_fd;
+	pollfd[0].events = POLLOUT;
+	pollfd[1].fd = vpu_dec->wakeup_fd[0];
+	pollfd[1].events = POLLIN;
+
+	for (;;) {
+		/* skip what has been written and empty pieces */
+		while (count && (guint) ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (!count)
+			break;
+		iov->iov_base = (guint8 *) iov->iov_base + ret;
+		iov->iov_len -= ret;
+
+		ret = poll(pollfd, 2, -1);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			return GST_FLOW_ERROR;
+		}
+		ret = 0;
+
+		if ((pollfd[1].revents & POLLIN) &&
+				!mfw_gst_vpudec_wait_cache_seek(vpu_dec))
+			continue;
+
+		if (pollfd[1].revents & POLLIN)
+			return vpu_dec->output_flow != GST_FLOW_OK ?
+				vpu_dec->output_flow : GST_FLOW_WRONG_STATE;
+
+		if (pollfd[0].revents & POLLERR) {
+			GST_DEBUG_OBJECT(vpu_dec, "POLLERR\n");
+			return GST_FLOW_ERROR;
+		}
+
+		if (pollfd[0].revents & POLLOUT) {
+			if (count == 1) {
+				ret = write(vpu_dec->vpu_fd, iov->iov_base,
+						iov->iov_len);
+			} else {
+				wv.iov = iov;
+				wv.count = count;
+				ret = ioctl(vpu_dec->vpu_fd, VPU_IOC_WRITEV, &wv);
+				if (ret == 0)
+					ret = wv.written;
+			}
+			if (ret == -1)
+				return GST_FLOW_ERROR;
+
+			if (G_UNLIKELY(vpu_dec->init == FALSE)) {
+				retval = mfw_gst_vpudec_vpu_init(vpu_dec);
+				if (retval == -EAGAIN)
+					continue;
+				if (retval) {
+					GST_ERROR("mfw_gst_vpudec_vpu_init failed initializing VPU");
+					return GST_FLOW_ERROR;
+				}
+				mfw_gst_vpudec_start_output(vpu_dec);
+			}
+		}
+	}
+
+	return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+mfw_gst_vpudec_write(GstVPU_Dec *vpu_dec, const guint8 *data, guint size)
+{
+	struct iovec iov = { (void *) data, size };
+
+	return mfw_gst_vpudec_writev(vpu_dec, &iov, 1);
+}
+
+/*
+ * Let the VPU decode all data written so far and wait until the output
+ * task has pushed the last picture.
+ */
+static GstFlowReturn mfw_gst_vpudec_drain(GstVPU_Dec *vpu_dec)
+{
+	GstFlowReturn retval = GST_FLOW_OK;
+
+	g_mutex_lock(vpu_dec->buf_lock);
+	vpu_dec->draining = TRUE;
+	g_mutex_unlock(vpu_dec->buf_lock);
+
+	/* a zero length write makes the VPU decode the remaining data */
+	write(vpu_dec->vpu_fd, NULL, 0);
+
+	g_mutex_lock(vpu_dec->buf_lock);
+	while (vpu_dec->draining &&
+			(!vpu_dec->flushing || vpu_dec->cache_seek))
+		g_cond_wait(vpu_dec->drain_cond, vpu_dec->buf_lock);
+	if (vpu_dec->draining)
+		retval = vpu_dec->output_flow != GST_FLOW_OK ?
+			vpu_dec->output_flow : GST_FLOW_WRONG_STATE;
+	vpu_dec->draining = FALSE;
+	g_mutex_unlock(vpu_dec->buf_lock);
+
+	/* wait for the task to finish its last iteration */
+	if (retval == GST_FLOW_OK)
+		gst_pad_pause_task(vpu_dec->srcpad);
+
+	return retval;
+}
+
+/*
+ * In low latency mode streams coded in output order are decoded without
+ * display reordering, so every picture comes out as soon as it is
+ * decoded. All other streams are reordered. The driver picks this up
+ * with the next sequence header.
+ */
+static void mfw_gst_vpudec_set_low_delay(GstVPU_Dec *vpu_dec,
+		gboolean low_delay)
+{
+	gint on = vpu_dec->low_latency && low_delay;
+
+	if (on == vpu_dec->low_delay_state)
+		return;
+
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_LOW_LATENCY, on)) {
+		GST_WARNING_OBJECT(vpu_dec, "VPU_IOC_LOW_LATENCY failed: %s",
+				strerror(errno));
+		return;
+	}
+	vpu_dec->low_delay_state = on;
+}
+
+/*
+ * The VPU decodes into frame buffers sized by the sequence header. For
+ * a new picture size the decoder is drained and set up again from the
+ * next write on, which renegotiates the caps and the capture queue.
+ */
+static GstFlowReturn mfw_gst_vpudec_seq_change(GstVPU_Dec *vpu_dec)
+{
+	unsigned long type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	GstFlowReturn retval;
+
+	retval = mfw_gst_vpudec_drain(vpu_dec);
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	if (ioctl(vpu_dec->vpu_fd, VIDIOC_STREAMOFF, &type))
+		GST_WARNING_OBJECT(vpu_dec, "streamoff failed: %s", strerror(errno));
+
+	mfw_gst_vpudec_buffers_unref(vpu_dec);
+
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_SEQ_CHANGE)) {
+		GST_ELEMENT_ERROR(vpu_dec, STREAM, DECODE, (NULL),
+				("VPU_IOC_SEQ_CHANGE failed: %s", strerror(errno)));
+		return GST_FLOW_ERROR;
+	}
+
+	vpu_dec->init = FALSE;
+
+	return GST_FLOW_OK;
+}
+
+/*
+ * Set up the decoder from a sequence header parsed by us instead of
+ * waiting for the VPU to find it in the bitstream. The kernel allocates
+ * the frame buffers and the capture queue is set up while the first
+ * pictures are still arriving. Older drivers don't know the hint.
+ */
+static void mfw_gst_vpudec_preinit(GstVPU_Dec *vpu_dec,
+		const MfwGstVpuSeqInfo *info)
+{
+	struct vpu_seq_hint hint = {
+		.width = info->width,
+		.height = info->height,
+		.num_ref_frames = info->num_ref_frames,
+		.visible = {
+			.left = info->crop_left,
+			.top = info->crop_top,
+			.width = info->width - info->crop_left - info->crop_right,
+			.height = info->height - info->crop_top - info->crop_bottom,
+		},
+	};
+
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_SEQ_HINT, &hint)) {
+		GST_DEBUG_OBJECT(vpu_dec, "VPU_IOC_SEQ_HINT failed: %s",
+				strerror(errno));
+		return;
+	}
+
+	GST_DEBUG_OBJECT(vpu_dec, "setting up for %dx%d, %d reference frames",
+			info->width, info->height, info->num_ref_frames);
+
+	/* retried after the next write if this fails */
+	if (mfw_gst_vpudec_vpu_init(vpu_dec))
+		return;
+
+	mfw_gst_vpudec_start_output(vpu_dec);
+}
+
+/*
+ * Tell the driver the picture written last is complete. For MJPEG and
+ * DivX 3 it only keeps the ends of a few pictures, wait until the VPU
+ * has taken one if they are all in use.
+ */
+static GstFlowReturn mfw_gst_vpudec_pic_end(GstVPU_Dec *vpu_dec)
+{
+	struct pollfd pollfd[2];
+
+	pollfd[0].fd = vpu_dec->vpu_fd;
+	pollfd[0].events = POLLOUT;
+	pollfd[1].fd = vpu_dec->wakeup_fd[0];
+	pollfd[1].events = POLLIN;
+
+	while (ioctl(vpu_dec->vpu_fd, VPU_IOC_PIC_END)) {
+		if (errno != ENOSPC) {
+			GST_ELEMENT_ERROR(vpu_dec, STREAM, DECODE, (NULL),
+					("VPU_IOC_PIC_END failed: %s",
+					 strerror(errno)));
+			return GST_FLOW_ERROR;
+		}
+
+		if (poll(pollfd, 2, -1) < 0 && errno != EINTR)
+			return GST_FLOW_ERROR;
+
+		if ((pollfd[1].revents & POLLIN) &&
+				!mfw_gst_vpudec_wait_cache_seek(vpu_dec))
+			continue;
+
+		if (pollfd[1].revents & POLLIN)
+			return vpu_dec->output_flow != GST_FLOW_OK ?
+				vpu_dec->output_flow : GST_FLOW_WRONG_STATE;
+	}
+
+	return GST_FLOW_OK;
+}
+
+/* Look for a sequence header with a new picture size in data */
+static GstFlowReturn
+mfw_gst_vpudec_check_seq(GstVPU_Dec *vpu_dec, const guint8 *data, guint size)
+{
+	MfwGstVpuSeqInfo info;
+	gboolean changed;
+
+	if (!mfw_gst_vpu_find_seq_info(vpu_dec->codec, data, size, &info))
+		return GST_FLOW_OK;
+
+	mfw_gst_vpudec_set_low_delay(vpu_dec, info.low_delay);
+
+	if (info.width == vpu_dec->seq_width &&
+			info.height == vpu_dec->seq_height)
+		return GST_FLOW_OK;
+
+	changed = vpu_dec->seq_width != 0;
+	vpu_dec->seq_width = info.width;
+	vpu_dec->seq_height = info.height;
+
+	if (!vpu_dec->init) {
+		mfw_gst_vpudec_preinit(vpu_dec, &info);
+		return GST_FLOW_OK;
+	}
+
+	if (!changed)
+		return GST_FLOW_OK;
+
+	GST_INFO_OBJECT(vpu_dec, "picture size changes to %dx%d",
+			info.width, info.height);
+
+	return mfw_gst_vpudec_seq_change(vpu_dec);
+}
+
+/*
+ * Returns the size of the first complete access unit in the adapter or
+ * 0 if more data is needed.
+ */
+static guint mfw_gst_vpudec_next_au(GstVPU_Dec *vpu_dec)
+{
+	guint avail = gst_adapter_available(vpu_dec->adapter);
+	const guint8 *data;
+	gint pos;
+
+	if (vpu_dec->scan_ofs + 5 > avail)
+		return 0;
+
+	/*
+	 * The whole access unit is peeked for writing it anyway. Only the
+	 * data added since the last call is scanned.
+	 */
+	data = gst_adapter_peek(vpu_dec->adapter, avail);
+
+	while (vpu_dec->scan_ofs + 5 <= avail) {
+		pos = mfw_gst_vpu_find_start_code(data + vpu_dec->scan_ofs,
+				avail - vpu_dec->scan_ofs);
+		if (pos < 0) {
+			/* the last bytes may be the beginning of a start code */
+			vpu_dec->scan_ofs = avail - 2;
+			break;
+		}
+		pos += vpu_dec->scan_ofs;
+
+		if (pos + 5 > avail) {
+			/* need the unit header */
+			vpu_dec->scan_ofs = pos;
+			break;
+		}
+
+		/*
+		 * The unit at the start of the adapter is classified as well,
+		 * it may be the picture of the access unit.
+		 */
+		if (mfw_gst_vpu_starts_au(vpu_dec->codec, data + pos + 3,
+					&vpu_dec->au_has_picture) && pos > 0) {
+			vpu_dec->scan_ofs = 0;
+			vpu_dec->au_has_picture = FALSE;
+			return pos;
+		}
+
+		vpu_dec->scan_ofs = pos + 3;
+	}
+
+	return 0;
+}
+
+/* Write one complete access unit and tell the VPU it can be decoded */
+static GstFlowReturn mfw_gst_vpudec_write_au(GstVPU_Dec *vpu_dec, guint size)
+{
+	GstFlowReturn retval;
+	GstClockTime timestamp;
+	guint64 distance;
+
+	/*
+	 * The timestamp belongs to the access unit starting a buffer. The
+	 * duration is lost in the adapter, the frame rate is used instead.
+	 */
+	timestamp = gst_adapter_prev_timestamp(vpu_dec->adapter, &distance);
+	if (GST_CLOCK_TIME_IS_VALID(timestamp) && distance == 0)
+		mfw_gst_vpudec_set_timestamp(vpu_dec, timestamp,
+				GST_CLOCK_TIME_NONE);
+
+	retval = mfw_gst_vpudec_check_seq(vpu_dec,
+			gst_adapter_peek(vpu_dec->adapter, size), size);
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	retval = mfw_gst_vpudec_write(vpu_dec,
+			gst_adapter_peek(vpu_dec->adapter, size), size);
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	gst_adapter_flush(vpu_dec->adapter, size);
+
+	return mfw_gst_vpudec_pic_end(vpu_dec);
+}
+
+static void mfw_gst_vpudec_reset_au(GstVPU_Dec *vpu_dec)
+{
+	gst_adapter_clear(vpu_dec->adapter);
+	vpu_dec->scan_ofs = 0;
+	vpu_dec->au_has_picture = FALSE;
+}
+
+static guint mfw_gst_vpudec_read_nal_length(const guint8 *data, guint size)
+{
+	guint len = 0;
+
+	while (size--)
+		len = (len << 8) | *data++;
+
+	return len;
+}
+
+/*
+ * Write an H.264 access unit in avc stream format, replacing the length
+ * prefixes with start codes on the way. Four byte length fields are
+ * overwritten in place when possible, so the buffer can be written at
+ * once, otherwise every NAL unit is written separately.
+ */
+static GstFlowReturn
+mfw_gst_vpudec_write_avc(GstVPU_Dec *vpu_dec, GstBuffer *buffer)
+{
+	static const guint8 start_code[4] = { 0, 0, 0, 1 };
+	GstFlowReturn retval = GST_FLOW_OK;
+	guint8 *data = GST_BUFFER_DATA(buffer);
+	guint size = GST_BUFFER_SIZE(buffer);
+	guint n = vpu_dec->nal_length_size;
+	gboolean in_place = n == sizeof(start_code) &&
+		gst_buffer_is_writable(buffer);
+	guint ofs = 0, len;
+
+	while (ofs + n <= size) {
+		len = mfw_gst_vpudec_read_nal_length(data + ofs, n);
+		if (len > size - ofs - n) {
+			GST_WARNING_OBJECT(vpu_dec, "truncated NAL unit");
+			break;
+		}
+
+		if (in_place) {
+			memcpy(data + ofs, start_code, sizeof(start_code));
+		} else {
+			retval = mfw_gst_vpudec_write(vpu_dec, start_code,
+					sizeof(start_code));
+			if (retval == GST_FLOW_OK)
+				retval = mfw_gst_vpudec_write(vpu_dec,
+						data + ofs + n, len);
+			if (retval != GST_FLOW_OK)
+				return retval;
+		}
+
+		ofs += n + len;
+	}
+
+	if (in_place)
+		retval = mfw_gst_vpudec_write(vpu_dec, data, ofs);
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	/* every buffer holds a complete access unit */
+	return mfw_gst_vpudec_pic_end(vpu_dec);
+}
+
+/*
+ * Write a JPEG picture. The Huffman tables, which Motion JPEG usually
+ * leaves out, are inserted in front of the scan.
+ */
+static GstFlowReturn
+mfw_gst_vpudec_write_jpeg(GstVPU_Dec *vpu_dec, GstBuffer *buffer)
+{
+	GstFlowReturn retval;
+	guint8 *data = GST_BUFFER_DATA(buffer);
+	guint size = GST_BUFFER_SIZE(buffer);
+	gboolean yuv422;
+	gint dht_ofs, width, height;
+
+	if (!mfw_gst_vpu_jpeg_parse(data, size, &dht_ofs, &yuv422,
+				&width, &height)) {
+		GST_WARNING_OBJECT(vpu_dec,
+				"dropping invalid or unsupported JPEG picture");
+		return GST_FLOW_OK;
+	}
+
+	/* every picture has its own size and chroma format */
+	if (vpu_dec->init && (width != vpu_dec->seq_width ||
+				height != vpu_dec->seq_height ||
+				yuv422 != vpu_dec->jpeg_422)) {
+		GST_INFO_OBJECT(vpu_dec, "picture changes to %dx%d %s",
+				width, height, yuv422 ? "4:2:2" : "4:2:0");
+		retval = mfw_gst_vpudec_seq_change(vpu_dec);
+		if (retval != GST_FLOW_OK)
+			return retval;
+	}
+
+	/* the frame buffers are allocated with the first picture */
+	if (!vpu_dec->init && yuv422 != vpu_dec->jpeg_422) {
+		guint32 pixelformat = yuv422 ?
+			V4L2_PIX_FMT_YUV422P : V4L2_PIX_FMT_YUV420;
+		struct v4l2_format fmt = {
+			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		};
+
+		/* decoding into smaller frame buffers would overrun them */
+		fmt.fmt.pix.pixelformat = pixelformat;
+		if (ioctl(vpu_dec->vpu_fd, VIDIOC_S_FMT, &fmt) ||
+				fmt.fmt.pix.pixelformat != pixelformat) {
+			GST_WARNING_OBJECT(vpu_dec, "dropping %s JPEG picture, "
+					"the VPU doesn't support it",
+					yuv422 ? "4:2:2" : "4:2:0");
+			return GST_FLOW_OK;
+		}
+		vpu_dec->jpeg_422 = yuv422;
+	}
+	vpu_dec->seq_width = width;
+	vpu_dec->seq_height = height;
+
+	if (dht_ofs < 0) {
+		retval = mfw_gst_vpudec_write(vpu_dec, data, size);
+	} else {
+		retval = mfw_gst_vpudec_write(vpu_dec, data, dht_ofs);
+		if (retval == GST_FLOW_OK)
+			retval = mfw_gst_vpudec_write(vpu_dec,
+					mfw_gst_vpu_jpeg_dht,
+					MFW_GST_VPU_JPEG_DHT_SIZE);
+		if (retval == GST_FLOW_OK)
+			retval = mfw_gst_vpudec_write(vpu_dec, data + dht_ofs,
+					size - dht_ofs);
+	}
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	/* JPEG has no start codes, the driver needs to know the end */
+	return mfw_gst_vpudec_pic_end(vpu_dec);
+}
+
+/*
+ * Write a picture of a codec without start codes in the stream, adding
+ * the frame header the VPU expects: the RCV frame layer for VC-1 simple
+ * and main profile, a frame start code for VC-1 advanced profile and the
+ * slice table for RealVideo. DivX 3 pictures go in as they are.
+ */
+static GstFlowReturn
+mfw_gst_vpudec_write_frame(GstVPU_Dec *vpu_dec, GstBuffer *buffer)
+{
+	static const guint8 vc1_frame_sc[4] = { 0, 0, 1, 0x0d };
+	GstFlowReturn retval = GST_FLOW_OK;
+	guint8 *data = GST_BUFFER_DATA(buffer);
+	guint size = GST_BUFFER_SIZE(buffer);
+	guint8 hdr[MFW_GST_VPU_RV_FRAME_MAX];
+	guint hdr_size = 0, ms = 0;
+
+	if (GST_BUFFER_TIMESTAMP_IS_VALID(buffer))
+		ms = GST_BUFFER_TIMESTAMP(buffer) / GST_MSECOND;
+
+	if (vpu_dec->vc1_rcv) {
+		mfw_gst_vpu_vc1_rcv_frame(hdr, size, !GST_BUFFER_FLAG_IS_SET(buffer,
+				GST_BUFFER_FLAG_DELTA_UNIT), ms);
+		hdr_size = MFW_GST_VPU_RCV_FRAME_SIZE;
+	} else if (vpu_dec->vc1_ap) {
+		if (size < 3 || data[0] || data[1] || data[2] != 1) {
+			memcpy(hdr, vc1_frame_sc, sizeof(vc1_frame_sc));
+			hdr_size = sizeof(vc1_frame_sc);
+		}
+	} else if (vpu_dec->codec == STD_RV) {
+		guint ofs;
+
+		hdr_size = mfw_gst_vpu_rv_frame(hdr, data, size, ms,
+				vpu_dec->rv_seq++, &ofs);
+		if (!hdr_size) {
+			GST_WARNING_OBJECT(vpu_dec, "dropping invalid RealVideo frame");
+			return GST_FLOW_OK;
+		}
+		data += ofs;
+		size -= ofs;
+	}
+
+	if (hdr_size)
+		retval = mfw_gst_vpudec_write(vpu_dec, hdr, hdr_size);
+	if (retval == GST_FLOW_OK)
+		retval = mfw_gst_vpudec_write(vpu_dec, data, size);
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	return mfw_gst_vpudec_pic_end(vpu_dec);
+}
+
+/*
+ * Switch the firmware between decoding every picture and parsing and
+ * dropping all but the intra pictures, for fast forward and scrubbing.
+ */
+static void mfw_gst_vpudec_update_keyframe_only(GstVPU_Dec *vpu_dec)
+{
+	gint on = vpu_dec->keyframe_only || vpu_dec->trick_mode;
+
+	if (on == vpu_dec->iframe_state)
+		return;
+
+	GST_DEBUG_OBJECT(vpu_dec, "%s keyframe only decoding",
+			on ? "enabling" : "disabling");
+
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_IFRAME_ONLY, on)) {
+		GST_WARNING_OBJECT(vpu_dec, "VPU_IOC_IFRAME_ONLY failed: %s",
+				strerror(errno));
+		return;
+	}
+	vpu_dec->iframe_state = on;
+}
+
+/*
+ * Decode the rest of the GOP written at a negative rate into the frame
+ * cache, push it in reverse and start over with the previous GOP.
+ */
+static GstFlowReturn mfw_gst_vpudec_next_gop(GstVPU_Dec *vpu_dec)
+{
+	GstFlowReturn retval = GST_FLOW_OK;
+
+	/* the last access unit has no start code following it */
+	if (gst_adapter_available(vpu_dec->adapter))
+		mfw_gst_vpudec_write_au(vpu_dec,
+				gst_adapter_available(vpu_dec->adapter));
+	mfw_gst_vpudec_reset_au(vpu_dec);
+
+	if (vpu_dec->init) {
+		retval = mfw_gst_vpudec_drain(vpu_dec);
+		if (retval != GST_FLOW_OK)
+			return retval;
+	}
+
+	retval = mfw_gst_vpudec_push_reverse(vpu_dec);
+	vpu_dec->reverse_gop = FALSE;
+
+	/* the VPU has seen the end of the bitstream, reset it */
+	mfw_gst_vpudec_flush(vpu_dec);
+	if (vpu_dec->init && retval == GST_FLOW_OK)
+		mfw_gst_vpudec_start_output(vpu_dec);
+
+	return retval;
+}
+
+/*
+ * Write a buffer from upstream to the VPU. This runs in the streaming
+ * thread or, with the input queue, in the input task.
+ */
+static GstFlowReturn
+mfw_gst_vpudec_decode(GstVPU_Dec *vpu_dec, GstBuffer *buffer)
+{
+	GstFlowReturn retval = GST_FLOW_OK;
+	GstClockTime timestamp = GST_BUFFER_TIMESTAMP(buffer);
+	GstClockTime duration = GST_BUFFER_DURATION(buffer);
+	guint size;
+
+	GST_DEBUG_OBJECT(vpu_dec, "frame input: ts = %" GST_TIME_FORMAT,
+			GST_TIME_ARGS(timestamp));
+
+	/* report errors and EOS of the output task upstream */
+	mfw_gst_vpudec_wait_cache_seek(vpu_dec);
+	if (vpu_dec->init && vpu_dec->output_flow != GST_FLOW_OK) {
+		retval = vpu_dec->output_flow;
+		gst_buffer_unref(buffer);
+		return retval;
+	}
+
+	/* at a negative rate every GOP starts with a discontinuity */
+	if (mfw_gst_vpudec_reverse(vpu_dec)) {
+		if (GST_BUFFER_IS_DISCONT(buffer) && vpu_dec->reverse_gop)
+			retval = mfw_gst_vpudec_next_gop(vpu_dec);
+		vpu_dec->reverse_gop = TRUE;
+		if (retval != GST_FLOW_OK) {
+			gst_buffer_unref(buffer);
+			return retval;
+		}
+	}
+
+	mfw_gst_vpudec_update_keyframe_only(vpu_dec);
+
+	/*
+	 * Feed complete access units so that the VPU can start decoding a
+	 * picture without waiting for the next one.
+	 */
+	if (mfw_gst_vpu_au_supported(vpu_dec->codec) && !vpu_dec->avc) {
+		if (!vpu_dec->once) {
+			if (vpu_dec->hdr_ext_data) {
+				GstBuffer *hdr = gst_buffer_make_metadata_writable(
+						gst_buffer_ref(vpu_dec->hdr_ext_data));
+
+				/* the header starts the first access unit */
+				GST_BUFFER_TIMESTAMP(hdr) = timestamp;
+				gst_adapter_push(vpu_dec->adapter, hdr);
+			}
+			vpu_dec->once = 1;
+		}
+
+		gst_adapter_push(vpu_dec->adapter, buffer);
+
+		/* don't wait for the next access unit to end this one */
+		if (vpu_dec->au_aligned) {
+			size = gst_adapter_available(vpu_dec->adapter);
+			if (size)
+				retval = mfw_gst_vpudec_write_au(vpu_dec, size);
+			return retval;
+		}
+
+		while ((size = mfw_gst_vpudec_next_au(vpu_dec))) {
+			retval = mfw_gst_vpudec_write_au(vpu_dec, size);
+			if (retval != GST_FLOW_OK)
+				break;
+		}
+
+		return retval;
+	}
+
+	if (GST_CLOCK_TIME_IS_VALID(timestamp))
+		mfw_gst_vpudec_set_timestamp(vpu_dec, timestamp, duration);
+
+	/* the codec header is written in front of the first picture */
+	if (!vpu_dec->once) {
+		if (vpu_dec->hdr_ext_data)
+			retval = mfw_gst_vpudec_check_seq(vpu_dec,
+					GST_BUFFER_DATA(vpu_dec->hdr_ext_data),
+					GST_BUFFER_SIZE(vpu_dec->hdr_ext_data));
+		if (vpu_dec->hdr_ext_data && retval == GST_FLOW_OK)
+			retval = mfw_gst_vpudec_write(vpu_dec,
+					GST_BUFFER_DATA(vpu_dec->hdr_ext_data),
+					GST_BUFFER_SIZE(vpu_dec->hdr_ext_data));
+		vpu_dec->once = 1;
+	}
+
+	if (retval == GST_FLOW_OK) {
+		if (vpu_dec->avc)
+			retval = mfw_gst_vpudec_write_avc(vpu_dec, buffer);
+		else if (vpu_dec->codec == STD_MJPG)
+			retval = mfw_gst_vpudec_write_jpeg(vpu_dec, buffer);
+		else if (vpu_dec->codec == STD_VC1 ||
+				vpu_dec->codec == STD_DIV3 ||
+				vpu_dec->codec == STD_RV)
+			retval = mfw_gst_vpudec_write_frame(vpu_dec, buffer);
+		else {
+			/* H.263 picture headers carry the picture size */
+			if (vpu_dec->codec == STD_H263)
+				retval = mfw_gst_vpudec_check_seq(vpu_dec,
+						GST_BUFFER_DATA(buffer),
+						GST_BUFFER_SIZE(buffer));
+			if (retval == GST_FLOW_OK)
+				retval = mfw_gst_vpudec_write(vpu_dec,
+						GST_BUFFER_DATA(buffer),
+						GST_BUFFER_SIZE(buffer));
+		}
+	}
+
+	gst_buffer_unref(buffer);
+
+	return retval;
+}
+
+/* The bitstream is written as it comes, without parsing or framing */
+static gboolean mfw_gst_vpudec_raw_stream(GstVPU_Dec *vpu_dec)
+{
+	if (vpu_dec->avc || mfw_gst_vpu_au_supported(vpu_dec->codec))
+		return FALSE;
+
+	return vpu_dec->codec != STD_MJPG && vpu_dec->codec != STD_VC1 &&
+		vpu_dec->codec != STD_DIV3 && vpu_dec->codec != STD_RV;
+}
+
+static GstFlowReturn mfw_gst_vpudec_write_iov(GstVPU_Dec *vpu_dec, GArray *iov)
+{
+	GstFlowReturn retval = GST_FLOW_OK;
+
+	if (iov->len)
+		retval = mfw_gst_vpudec_writev(vpu_dec,
+				(struct iovec *) iov->data, iov->len);
+	g_array_set_size(iov, 0);
+
+	return retval;
+}
+
+/*
+ * With access unit aligned caps a group of a buffer list is one access
+ * unit, e.g. the fragments of a picture from an RTP depayloader. It goes
+ * to the VPU in one VPU_IOC_WRITEV followed by a single picture end.
+ */
+static GstFlowReturn
+mfw_gst_vpudec_write_au_group(GstVPU_Dec *vpu_dec, GstBufferListIterator *it,
+		GArray *iov)
+{
+	GstFlowReturn retval = GST_FLOW_OK;
+	GstBuffer *buffer;
+	struct iovec piece;
+	gboolean first = TRUE;
+
+	while ((buffer = gst_buffer_list_iterator_next(it))) {
+		if (first && GST_BUFFER_TIMESTAMP_IS_VALID(buffer))
+			mfw_gst_vpudec_set_timestamp(vpu_dec,
+					GST_BUFFER_TIMESTAMP(buffer),
+					GST_BUFFER_DURATION(buffer));
+		first = FALSE;
+
+		/* parameter sets come in pieces of their own */
+		if (retval == GST_FLOW_OK)
+			retval = mfw_gst_vpudec_check_seq(vpu_dec,
+					GST_BUFFER_DATA(buffer),
+					GST_BUFFER_SIZE(buffer));
+
+		piece.iov_base = GST_BUFFER_DATA(buffer);
+		piece.iov_len = GST_BUFFER_SIZE(buffer);
+		g_array_append_val(iov, piece);
+	}
+
+	if (retval != GST_FLOW_OK || !iov->len) {
+		g_array_set_size(iov, 0);
+		return retval;
+	}
+
+	retval = mfw_gst_vpudec_write_iov(vpu_dec, iov);
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	return mfw_gst_vpudec_pic_end(vpu_dec);
+}
+
+/*
+ * Buffer lists, as from RTP depayloaders, carry a picture in many small
+ * pieces. A raw bitstream goes to the VPU in one VPU_IOC_WRITEV per
+ * timestamp rather than in a write per buffer, access unit aligned
+ * H.264 and MPEG-4 in one per group. Otherwise the buffers are decoded
+ * one by one, groups being merged where the framing needs them whole.
+ */
+static GstFlowReturn
+mfw_gst_vpudec_decode_list(GstVPU_Dec *vpu_dec, GstBufferList *list)
+{
+	GstFlowReturn retval = GST_FLOW_OK;
+	GstBufferListIterator *it;
+	GstBuffer *buffer;
+	GstClockTime last_ts = GST_CLOCK_TIME_NONE;
+	GArray *iov;
+	struct iovec piece;
+	gboolean first, au_group;
+
+	/* report errors and EOS of the output task upstream */
+	mfw_gst_vpudec_wait_cache_seek(vpu_dec);
+	if (vpu_dec->init && vpu_dec->output_flow != GST_FLOW_OK) {
+		retval = vpu_dec->output_flow;
+		gst_buffer_list_unref(list);
+		return retval;
+	}
+
+	iov = g_array_new(FALSE, FALSE, sizeof(struct iovec));
+	it = gst_buffer_list_iterate(list);
+
+	while (retval == GST_FLOW_OK &&
+			gst_buffer_list_iterator_next_group(it)) {
+		au_group = mfw_gst_vpu_au_supported(vpu_dec->codec) &&
+			!vpu_dec->avc && vpu_dec->au_aligned;
+
+		/* the codec header and reverse GOPs need the single path */
+		if ((!au_group && !mfw_gst_vpudec_raw_stream(vpu_dec)) ||
+				!vpu_dec->once ||
+				mfw_gst_vpudec_reverse(vpu_dec)) {
+			retval = mfw_gst_vpudec_write_iov(vpu_dec, iov);
+			if (retval != GST_FLOW_OK)
+				break;
+
+			if (mfw_gst_vpu_au_supported(vpu_dec->codec) &&
+					!vpu_dec->avc && !au_group) {
+				/* the adapter finds the access units anyway */
+				while (retval == GST_FLOW_OK &&
+						(buffer = gst_buffer_list_iterator_next(it)))
+					retval = mfw_gst_vpudec_decode(vpu_dec,
+							gst_buffer_ref(buffer));
+			} else {
+				buffer = gst_buffer_list_iterator_merge_group(it);
+				if (buffer)
+					retval = mfw_gst_vpudec_decode(vpu_dec,
+							buffer);
+			}
+			continue;
+		}
+
+		mfw_gst_vpudec_update_keyframe_only(vpu_dec);
+
+		if (au_group) {
+			retval = mfw_gst_vpudec_write_iov(vpu_dec, iov);
+			if (retval == GST_FLOW_OK)
+				retval = mfw_gst_vpudec_write_au_group(vpu_dec,
+						it, iov);
+			continue;
+		}
+
+		first = TRUE;
+		while ((buffer = gst_buffer_list_iterator_next(it))) {
+			/* the pieces of a picture usually share its timestamp */
+			if (first && GST_BUFFER_TIMESTAMP_IS_VALID(buffer) &&
+					GST_BUFFER_TIMESTAMP(buffer) != last_ts) {
+				retval = mfw_gst_vpudec_write_iov(vpu_dec, iov);
+				if (retval != GST_FLOW_OK)
+					break;
+				last_ts = GST_BUFFER_TIMESTAMP(buffer);
+				mfw_gst_vpudec_set_timestamp(vpu_dec, last_ts,
+						GST_BUFFER_DURATION(buffer));
+			}
+			first = FALSE;
+
+			piece.iov_base = GST_BUFFER_DATA(buffer);
+			piece.iov_len = GST_BUFFER_SIZE(buffer);
+			g_array_append_val(iov, piece);
+		}
+	}
+
+	if (retval == GST_FLOW_OK)
+		retval = mfw_gst_vpudec_write_iov(vpu_dec, iov);
+
+	gst_buffer_list_iterator_free(it);
+	g_array_free(iov, TRUE);
+	gst_buffer_list_unref(list);
+
+	return retval;
+}
+
+/* Serialized events, handled in the same thread as the buffers */
+static gboolean
+mfw_gst_vpudec_handle_event(GstVPU_Dec *vpu_dec, GstEvent * event)
+{
+	gboolean result = TRUE;
+	GstFormat format;
+	gint64 start, stop, position;
+	gdouble rate;
+	gboolean update;
+
+	switch (GST_EVENT_TYPE(event)) {
+	case GST_EVENT_NEWSEGMENT:
+		gst_event_parse_new_segment(event, &update, &rate, &format,
+					    &start, &stop, &position);
+		GST_DEBUG_OBJECT(vpu_dec, "receiving new seg start = %" GST_TIME_FORMAT
+			  " stop = %" GST_TIME_FORMAT
+			  " position in mpeg4  =%" GST_TIME_FORMAT,
+				GST_TIME_ARGS(start),
+				GST_TIME_ARGS(stop),
+				GST_TIME_ARGS(position));
+		vpu_dec->trick_mode = ABS(rate) > KEYFRAME_ONLY_RATE;
+		if (GST_FORMAT_TIME == format) {
+			GST_OBJECT_LOCK(vpu_dec);
+			gst_segment_set_newsegment(&vpu_dec->segment, update,
+					rate, format, start, stop, position);
+			GST_OBJECT_UNLOCK(vpu_dec);
+
+			result = gst_pad_push_event(vpu_dec->srcpad, event);
+			if (TRUE != result) {
+				GST_ERROR("Error in pushing the event, result is %d", result);
+			}
+		}
+		break;
+	case GST_EVENT_EOS:
+		/* the last access unit has no start code following it */
+		if (gst_adapter_available(vpu_dec->adapter))
+			mfw_gst_vpudec_write_au(vpu_dec,
+					gst_adapter_available(vpu_dec->adapter));
+		mfw_gst_vpudec_reset_au(vpu_dec);
+
+		/* the output task forwards EOS once the VPU is drained */
+		vpu_dec->eos = vpu_dec->init && vpu_dec->output_flow == GST_FLOW_OK;
+
+		write(vpu_dec->vpu_fd, NULL, 0);
+		GST_DEBUG_OBJECT(vpu_dec, "GST_EVENT_EOS: handled\n");
+
+		if (vpu_dec->eos) {
+			gst_event_unref(event);
+			break;
+		}
+
+		result = gst_pad_push_event(vpu_dec->srcpad, event);
+		if (TRUE != result)
+			GST_DEBUG_OBJECT(vpu_dec, "Error in pushing the event,result is %d", result);
+		if (GST_OBJECT_FLAG_IS_SET(vpu_dec, GST_ELEMENT_IS_SINK))
+			gst_element_post_message(GST_ELEMENT(vpu_dec),
+					gst_message_new_eos(GST_OBJECT(vpu_dec)));
+		break;
+	default:
+		result = gst_pad_event_default(vpu_dec->sinkpad, event);
+		break;
+	}
+
+	return result;
+}
+
+/* Bitstream bytes of a queued item */
+static guint mfw_gst_vpudec_item_size(GstMiniObject *item)
+{
+	GstBufferListIterator *it;
+	GstBuffer *buffer;
+	guint size = 0;
+
+	if (GST_IS_BUFFER(item))
+		return GST_BUFFER_SIZE(item);
+
+	if (GST_IS_BUFFER_LIST(item)) {
+		it = gst_buffer_list_iterate(GST_BUFFER_LIST(item));
+		while (gst_buffer_list_iterator_next_group(it)) {
+			while ((buffer = gst_buffer_list_iterator_next(it)))
+				size += GST_BUFFER_SIZE(buffer);
+		}
+		gst_buffer_list_iterator_free(it);
+	}
+
+	return size;
+}
+
+/* Drop the queued items, input_lock held */
+static void mfw_gst_vpudec_input_clear(GstVPU_Dec *vpu_dec)
+{
+	GstMiniObject *item;
 
-	return 0;
+	while ((item = g_queue_pop_head(&vpu_dec->input_queue)))
+		gst_mini_object_unref(item);
+	vpu_dec->input_bytes = 0;
 }
 
-static int vpu_dec_loop (GstVPU_Dec *vpu_dec)
+/*
+ * The input task writes the queued bitstream to the VPU as soon as there
+ * is space for it, so the VPU keeps decoding from the queue between
+ * bursts of input while upstream doesn't wait for the VPU. Once writing
+ * fails, buffers are dropped and the flow return goes upstream, events
+ * are still handled in order. The task pauses itself when flushing.
+ */
+static void mfw_gst_vpudec_input_loop(GstVPU_Dec *vpu_dec)
 {
-	GstBuffer *pushbuff;
-	int ret;
-	struct v4l2_buffer v4l2_buf = {
-		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
-	};
+	GstMiniObject *item;
+	GstFlowReturn retval = GST_FLOW_OK;
 
-	ret = ioctl(vpu_dec->vpu_fd, VIDIOC_DQBUF, &v4l2_buf);
-	if (ret)
-		return -errno;
+	g_mutex_lock(vpu_dec->input_lock);
+	while (g_queue_is_empty(&vpu_dec->input_queue) &&
+			!vpu_dec->input_flushing)
+		g_cond_wait(vpu_dec->input_cond, vpu_dec->input_lock);
 
-	if (vpu_dec->streamtype == V4L2_MEMORY_USERPTR) {
-		pushbuff = vpu_dec->buf_gst[v4l2_buf.index];
-		vpu_dec->buf_gst[v4l2_buf.index] = 0;
+	if (vpu_dec->input_flushing) {
+		g_mutex_unlock(vpu_dec->input_lock);
+		GST_DEBUG_OBJECT(vpu_dec, "pausing input task");
+		gst_task_pause(vpu_dec->input_task);
+		return;
+	}
 
-		ret = gst_pad_alloc_buffer_and_set_caps(vpu_dec->srcpad, 0,
-					      vpu_dec->outsize,
-					      GST_PAD_CAPS(vpu_dec->srcpad),
-					      &vpu_dec->buf_gst[v4l2_buf.index]);
-	} else {
-		ret = gst_pad_alloc_buffer_and_set_caps(vpu_dec->srcpad, 0,
-					      vpu_dec->outsize,
-					      GST_PAD_CAPS(vpu_dec->srcpad),
-					      &pushbuff);
+	item = g_queue_pop_head(&vpu_dec->input_queue);
+	if (!GST_IS_EVENT(item)) {
+		vpu_dec->input_bytes -= mfw_gst_vpudec_item_size(item);
+		if (vpu_dec->input_bytes <= vpu_dec->input_low)
+			g_cond_broadcast(vpu_dec->input_cond);
+		if (vpu_dec->input_flow != GST_FLOW_OK) {
+			if (g_queue_is_empty(&vpu_dec->input_queue))
+				g_cond_broadcast(vpu_dec->input_cond);
+			g_mutex_unlock(vpu_dec->input_lock);
+			gst_mini_object_unref(item);
+			return;
+		}
+	}
+	vpu_dec->input_busy = TRUE;
+	g_mutex_unlock(vpu_dec->input_lock);
+
+	if (GST_IS_BUFFER(item))
+		retval = mfw_gst_vpudec_decode(vpu_dec, GST_BUFFER(item));
+	else if (GST_IS_BUFFER_LIST(item))
+		retval = mfw_gst_vpudec_decode_list(vpu_dec,
+				GST_BUFFER_LIST(item));
+	else
+		mfw_gst_vpudec_handle_event(vpu_dec, GST_EVENT(item));
+
+	g_mutex_lock(vpu_dec->input_lock);
+	vpu_dec->input_busy = FALSE;
+	if (retval != GST_FLOW_OK && !vpu_dec->input_flushing) {
+		GST_DEBUG_OBJECT(vpu_dec, "input task failed: %s",
+				gst_flow_get_name(retval));
+		vpu_dec->input_flow = retval;
 	}
+	if (g_queue_is_empty(&vpu_dec->input_queue))
+		g_cond_broadcast(vpu_dec->input_cond);
+	g_mutex_unlock(vpu_dec->input_lock);
+}
 
-	if (ret != GST_FLOW_OK) {
-		GST_DEBUG_OBJECT(vpu_dec, "Allocating the Framebuffer[%d] failed with %d",
-		     0, ret);
-		goto done;
+/*
+ * Queue a buffer or buffer list, taking over the reference. Once more
+ * than input_high bytes are queued the streaming thread waits for the
+ * input task to get below input_low.
+ */
+static GstFlowReturn
+mfw_gst_vpudec_input_push(GstVPU_Dec *vpu_dec, GstMiniObject *item)
+{
+	GstFlowReturn retval = GST_FLOW_OK;
+	guint low = MIN(vpu_dec->input_low, vpu_dec->input_high);
+	guint size = mfw_gst_vpudec_item_size(item);
+
+	g_mutex_lock(vpu_dec->input_lock);
+	if (vpu_dec->input_bytes >= vpu_dec->input_high) {
+		while (vpu_dec->input_bytes > low && !vpu_dec->input_flushing &&
+				vpu_dec->input_flow == GST_FLOW_OK)
+			g_cond_wait(vpu_dec->input_cond, vpu_dec->input_lock);
 	}
 
-	if (vpu_dec->streamtype == V4L2_MEMORY_USERPTR)
-		v4l2_buf.m.userptr = (unsigned long)GST_BUFFER_DATA(vpu_dec->buf_gst[v4l2_buf.index]);
+	if (vpu_dec->input_flushing)
+		retval = GST_FLOW_WRONG_STATE;
 	else
-		memcpy(GST_BUFFER_DATA(pushbuff), vpu_dec->buf_data[v4l2_buf.index], vpu_dec->outsize);
+		retval = vpu_dec->input_flow;
 
-	ret = ioctl(vpu_dec->vpu_fd, VIDIOC_QBUF, &v4l2_buf);
-	if (ret) {
-		GST_DEBUG_OBJECT(vpu_dec, "Decoder qbuf failed?? error: %d\n", errno);
-		return GST_FLOW_ERROR;
+	if (retval != GST_FLOW_OK) {
+		g_mutex_unlock(vpu_dec->input_lock);
+		gst_mini_object_unref(item);
+		return retval;
 	}
 
-	/* Update the time stamp based on the frame-rate */
-	GST_BUFFER_SIZE(pushbuff) = vpu_dec->outsize;
-//	GST_BUFFER_TIMESTAMP(pushbuff) = GST_TIMEVAL_TO_TIME(v4l2_buf.timestamp);
-	GST_BUFFER_TIMESTAMP(pushbuff) = gst_util_uint64_scale(vpu_dec->decoded_frames,
-			vpu_dec->frame_rate_de * GST_SECOND,
-			vpu_dec->frame_rate_nu);
+	g_queue_push_tail(&vpu_dec->input_queue, item);
+	vpu_dec->input_bytes += size;
+	g_cond_broadcast(vpu_dec->input_cond);
+	g_mutex_unlock(vpu_dec->input_lock);
 
-	vpu_dec->decoded_frames++;
+	gst_task_start(vpu_dec->input_task);
 
-	GST_DEBUG_OBJECT(vpu_dec, "frame decoded : %lld ts = %" GST_TIME_FORMAT,
-			vpu_dec->decoded_frames,
-			GST_TIME_ARGS(GST_BUFFER_TIMESTAMP(pushbuff)));
+	return GST_FLOW_OK;
+}
 
-	ret = gst_pad_push(vpu_dec->srcpad, pushbuff);
-	if (ret != GST_FLOW_OK) {
-		GST_ERROR("Pushing the Output onto the Source Pad failed with %d", ret);
+/*
+ * Queue a serialized event behind the buffers, taking over the reference.
+ * Returns FALSE while flushing, the event is then handled right away.
+ */
+static gboolean mfw_gst_vpudec_input_push_event(GstVPU_Dec *vpu_dec,
+		GstEvent *event)
+{
+	g_mutex_lock(vpu_dec->input_lock);
+	if (vpu_dec->input_flushing) {
+		g_mutex_unlock(vpu_dec->input_lock);
+		return FALSE;
 	}
+	g_queue_push_tail(&vpu_dec->input_queue, event);
+	g_cond_broadcast(vpu_dec->input_cond);
+	g_mutex_unlock(vpu_dec->input_lock);
 
-	ret = 0;
-done:
-	return ret;
+	gst_task_start(vpu_dec->input_task);
+
+	return TRUE;
 }
 
-static GstFlowReturn
-mfw_gst_vpudec_chain_stream_mode(GstPad * pad, GstBuffer *buffer)
+/*
+ * Stop taking buffers and drop the queued ones. The input task pauses,
+ * once writing to the VPU is interrupted as well.
+ */
+static void mfw_gst_vpudec_input_flush(GstVPU_Dec *vpu_dec)
 {
-	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(GST_PAD_PARENT(pad));
-	int ret = 0;
-	GstFlowReturn retval = GST_FLOW_OK;
-	int remaining, ofs, handled = 0;
-	struct pollfd pollfd;
+	g_mutex_lock(vpu_dec->input_lock);
+	vpu_dec->input_flushing = TRUE;
+	mfw_gst_vpudec_input_clear(vpu_dec);
+	g_cond_broadcast(vpu_dec->input_cond);
+	g_mutex_unlock(vpu_dec->input_lock);
+}
 
-	GST_DEBUG_OBJECT(vpu_dec, "frame input: ts = %" GST_TIME_FORMAT,
-			GST_TIME_ARGS(GST_BUFFER_TIMESTAMP(buffer)));
+/* The task holds its lock for as long as it isn't paused */
+static void mfw_gst_vpudec_input_wait_paused(GstVPU_Dec *vpu_dec)
+{
+	g_static_rec_mutex_lock(&vpu_dec->input_task_lock);
+	g_static_rec_mutex_unlock(&vpu_dec->input_task_lock);
+}
 
-	if (!vpu_dec->once) {
-		if (vpu_dec->hdr_ext_data)
-			buffer = gst_buffer_join(vpu_dec->hdr_ext_data, buffer);
-		vpu_dec->once = 1;
-	}
+/*
+ * Wait for the input task to have handled everything queued, so that the
+ * streaming thread can set up the VPU for new caps.
+ */
+static void mfw_gst_vpudec_input_wait_idle(GstVPU_Dec *vpu_dec)
+{
+	g_mutex_lock(vpu_dec->input_lock);
+	while ((!g_queue_is_empty(&vpu_dec->input_queue) ||
+				vpu_dec->input_busy) &&
+			!vpu_dec->input_flushing)
+		g_cond_wait(vpu_dec->input_cond, vpu_dec->input_lock);
+	g_mutex_unlock(vpu_dec->input_lock);
+}
 
-	pollfd.fd = vpu_dec->vpu_fd;
-	pollfd.events = POLLIN | POLLOUT;
+static gboolean
+mfw_gst_vpudec_sink_activate_push(GstPad * pad, gboolean active)
+{
+	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(GST_PAD_PARENT(pad));
 
-	remaining = GST_BUFFER_SIZE(buffer);
-	ofs = 0;
+	if (active)
+		return TRUE;
 
-	while (!handled) {
-		ret = poll(&pollfd, 1, -1);
-		if (ret < 0) {
-			retval = GST_FLOW_ERROR;
-			goto done;
-		}
+	/* the input task is started with the first queued item */
+	mfw_gst_vpudec_input_flush(vpu_dec);
+	mfw_gst_vpudec_set_flushing(vpu_dec, TRUE);
+	gst_task_stop(vpu_dec->input_task);
 
-		if (pollfd.revents & POLLERR) {
-			GST_DEBUG_OBJECT(vpu_dec, "POLLERR\n");
-			retval = GST_FLOW_ERROR;
-			goto done;
-		}
+	return gst_task_join(vpu_dec->input_task);
+}
 
-		if ((pollfd.revents & POLLOUT) && buffer) {
-			ret = write(vpu_dec->vpu_fd, GST_BUFFER_DATA(buffer) + ofs,
-					remaining);
-			if (ret == -1) {
-				retval = GST_FLOW_ERROR;
-				goto done;
-			}
+static GstFlowReturn
+mfw_gst_vpudec_chain_stream_mode(GstPad * pad, GstBuffer *buffer)
+{
+	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(GST_PAD_PARENT(pad));
 
-			remaining -= ret;
-			ofs += ret;
+	if (vpu_dec->input_queued)
+		return mfw_gst_vpudec_input_push(vpu_dec,
+				GST_MINI_OBJECT(buffer));
 
-			if (G_UNLIKELY(vpu_dec->init == FALSE)) {
-				retval = mfw_gst_vpudec_vpu_init(vpu_dec);
-				if (retval == -EAGAIN) {
-					retval = GST_FLOW_OK;
-					goto done;
-				}
-				if (retval) {
-					GST_ERROR("mfw_gst_vpudec_vpu_init failed initializing VPU");
-					retval = GST_FLOW_ERROR;
-					goto done;
-				}
-			}
-			if (!remaining)
-				handled = 1;
-		}
+	return mfw_gst_vpudec_decode(vpu_dec, buffer);
+}
 
-		if (pollfd.revents & POLLIN)
-			while (!vpu_dec_loop(vpu_dec));
-	}
-done:
-	gst_buffer_unref(buffer);
+static GstFlowReturn
+mfw_gst_vpudec_chain_list(GstPad * pad, GstBufferList *list)
+{
+	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(GST_PAD_PARENT(pad));
 
-	return retval;
+	if (vpu_dec->input_queued)
+		return mfw_gst_vpudec_input_push(vpu_dec,
+				GST_MINI_OBJECT(list));
+
+	return mfw_gst_vpudec_decode_list(vpu_dec, list);
 }
 
 static gboolean
@@ -647,52 +3697,47 @@ mfw_gst_vpudec_sink_event(GstPad * pad, GstEvent * event)
 {
 	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(GST_PAD_PARENT(pad));
 	gboolean result = TRUE;
-	GstFormat format;
-	gint64 start, stop, position;
-	gdouble rate;
 
 	switch (GST_EVENT_TYPE(event)) {
-	case GST_EVENT_NEWSEGMENT:
-		gst_event_parse_new_segment(event, NULL, &rate, &format,
-					    &start, &stop, &position);
-		GST_DEBUG_OBJECT(vpu_dec, "receiving new seg start = %" GST_TIME_FORMAT
-			  " stop = %" GST_TIME_FORMAT
-			  " position in mpeg4  =%" GST_TIME_FORMAT,
-				GST_TIME_ARGS(start),
-				GST_TIME_ARGS(stop),
-				GST_TIME_ARGS(position));
-		if (GST_FORMAT_TIME == format) {
-			result = gst_pad_push_event(vpu_dec->srcpad, event);
-			if (TRUE != result) {
-				GST_ERROR("Error in pushing the event, result is %d", result);
-			}
-		}
-		break;
 	case GST_EVENT_FLUSH_STOP:
-		/* The below block of code is used to Flush the buffered input stream data */
-		GST_DEBUG_OBJECT(vpu_dec, "GST_EVENT_FLUSH_STOP: not handled\n");
+		GST_DEBUG_OBJECT(vpu_dec, "GST_EVENT_FLUSH_STOP: handled\n");
 
 		result = gst_pad_push_event(vpu_dec->srcpad, event);
 		if (TRUE != result) {
 			GST_DEBUG_OBJECT(vpu_dec, "Error in pushing the event,result is %d", result);
 			gst_event_unref(event);
 		}
-		break;
-	case GST_EVENT_EOS:
-		write(vpu_dec->vpu_fd, NULL, 0);
-		GST_DEBUG_OBJECT(vpu_dec, "GST_EVENT_EOS: handled\n");
-		result = gst_pad_push_event(vpu_dec->srcpad, event);
-		if (TRUE != result)
-			GST_DEBUG_OBJECT(vpu_dec, "Error in pushing the event,result is %d", result);
+
+		/*
+		 * Don't decode the old bitstream before the data after the
+		 * seek. Once the streaming thread has returned nothing writes
+		 * to the VPU any more.
+		 */
+		GST_PAD_STREAM_LOCK(vpu_dec->sinkpad);
+		mfw_gst_vpudec_flush(vpu_dec);
+		mfw_gst_vpudec_reset_au(vpu_dec);
+		GST_PAD_STREAM_UNLOCK(vpu_dec->sinkpad);
+
+		/* the cached pictures no longer lead up to the next one */
+		mfw_gst_vpudec_clear_cache(vpu_dec);
+		vpu_dec->reverse_gop = FALSE;
+
+		GST_OBJECT_LOCK(vpu_dec);
+		gst_segment_init(&vpu_dec->segment, GST_FORMAT_TIME);
+		GST_OBJECT_UNLOCK(vpu_dec);
+
+		mfw_gst_vpudec_set_flushing(vpu_dec, FALSE);
+		g_mutex_lock(vpu_dec->input_lock);
+		vpu_dec->input_flushing = FALSE;
+		vpu_dec->input_flow = GST_FLOW_OK;
+		g_mutex_unlock(vpu_dec->input_lock);
+		vpu_dec->eos = FALSE;
+		if (vpu_dec->init)
+			mfw_gst_vpudec_start_output(vpu_dec);
 		break;
 	case GST_EVENT_FLUSH_START:
-		if (vpu_dec->state == GST_STATE_PLAYING) {
-			while (1) {
-				result = vpu_dec_loop(vpu_dec);
-				if (result && result != -EAGAIN)
-					break;
-			}
-		}
+		mfw_gst_vpudec_input_flush(vpu_dec);
+		mfw_gst_vpudec_set_flushing(vpu_dec, TRUE);
 
 		GST_DEBUG_OBJECT(vpu_dec, "GST_EVENT_FLUSH_START: handled\n");
 		result = gst_pad_push_event(vpu_dec->srcpad, event);
@@ -700,15 +3745,189 @@ mfw_gst_vpudec_sink_event(GstPad * pad, GstEvent * event)
 			GST_DEBUG_OBJECT(vpu_dec, "Error in pushing the event,result is %d", result);
 			gst_event_unref(event);
 		}
+
+		/* the task sees the wakeup pipe and stops at the next iteration */
+		gst_pad_pause_task(vpu_dec->srcpad);
+		mfw_gst_vpudec_input_wait_paused(vpu_dec);
 		break;
 	default:
-		result = gst_pad_event_default(pad, event);
+		if (vpu_dec->input_queued && GST_EVENT_IS_SERIALIZED(event) &&
+				mfw_gst_vpudec_input_push_event(vpu_dec, event))
+			break;
+		result = mfw_gst_vpudec_handle_event(vpu_dec, event);
 		break;
 	}
 
 	return result;
 }
 
+/*
+ * Serve a flushing seek back to a picture in the frame cache without
+ * involving upstream. The cached pictures from there on are pushed
+ * again, followed by those decoded next, so playback continues where
+ * it would have after a seek upstream.
+ */
+static gboolean mfw_gst_vpudec_cache_seek(GstVPU_Dec *vpu_dec, GstEvent *event)
+{
+	GstFormat format;
+	GstSeekFlags flags;
+	GstSeekType start_type, stop_type;
+	gint64 start, stop;
+	gdouble rate;
+	GList *frames = NULL;
+
+	gst_event_parse_seek(event, &rate, &format, &flags, &start_type,
+			&start, &stop_type, &stop);
+
+	if (format != GST_FORMAT_TIME || !(flags & GST_SEEK_FLAG_FLUSH) ||
+			(flags & GST_SEEK_FLAG_SEGMENT) ||
+			start_type != GST_SEEK_TYPE_SET ||
+			stop_type != GST_SEEK_TYPE_NONE)
+		return FALSE;
+
+	if (!vpu_dec->init || vpu_dec->fb || vpu_dec->canvas ||
+			vpu_dec->eos || vpu_dec->output_flow != GST_FLOW_OK)
+		return FALSE;
+
+	GST_OBJECT_LOCK(vpu_dec);
+	if (rate == vpu_dec->segment.rate && rate > 0.0)
+		frames = mfw_gst_vpu_cache_from(&vpu_dec->cache, start);
+	GST_OBJECT_UNLOCK(vpu_dec);
+	if (!frames)
+		return FALSE;
+
+	GST_DEBUG_OBJECT(vpu_dec, "seeking to %" GST_TIME_FORMAT " in the frame cache",
+			GST_TIME_ARGS(start));
+
+	g_mutex_lock(vpu_dec->buf_lock);
+	vpu_dec->cache_seek = TRUE;
+	g_mutex_unlock(vpu_dec->buf_lock);
+
+	gst_pad_push_event(vpu_dec->srcpad, gst_event_new_flush_start());
+	mfw_gst_vpudec_set_flushing(vpu_dec, TRUE);
+	gst_pad_pause_task(vpu_dec->srcpad);
+
+	gst_pad_push_event(vpu_dec->srcpad, gst_event_new_flush_stop());
+	mfw_gst_vpudec_set_flushing(vpu_dec, FALSE);
+
+	GST_OBJECT_LOCK(vpu_dec);
+	gst_segment_set_newsegment(&vpu_dec->segment, FALSE, rate,
+			GST_FORMAT_TIME, start, -1, start);
+	GST_OBJECT_UNLOCK(vpu_dec);
+	gst_pad_push_event(vpu_dec->srcpad, gst_event_new_new_segment(FALSE,
+				rate, GST_FORMAT_TIME, start, -1, start));
+
+	/* the first picture starts before the segment */
+	frames->data = gst_buffer_make_metadata_writable(frames->data);
+	GST_BUFFER_FLAG_SET(frames->data, GST_BUFFER_FLAG_DISCONT);
+
+	/* the task has pushed or dropped all pictures of a former seek */
+	vpu_dec->replay = frames;
+	mfw_gst_vpudec_start_output(vpu_dec);
+
+	g_mutex_lock(vpu_dec->buf_lock);
+	vpu_dec->cache_seek = FALSE;
+	g_cond_broadcast(vpu_dec->drain_cond);
+	g_mutex_unlock(vpu_dec->buf_lock);
+
+	return TRUE;
+}
+
+static gboolean
+mfw_gst_vpudec_src_event(GstPad * pad, GstEvent * event)
+{
+	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(GST_PAD_PARENT(pad));
+	gdouble proportion;
+	GstClockTimeDiff diff;
+	GstClockTime timestamp;
+	gint skip;
+
+	switch (GST_EVENT_TYPE(event)) {
+	case GST_EVENT_QOS:
+		gst_event_parse_qos(event, &proportion, &diff, &timestamp);
+
+		/*
+		 * When the sink is late have the VPU skip non-reference
+		 * pictures until we have caught up. Those would be dropped
+		 * by the sink anyway.
+		 */
+		skip = diff > 0;
+
+		GST_DEBUG_OBJECT(vpu_dec, "QoS: proportion %lf diff %" G_GINT64_FORMAT,
+				proportion, diff);
+
+		if (skip != vpu_dec->skip_state) {
+			GST_DEBUG_OBJECT(vpu_dec, "%s skipping non-reference pictures",
+					skip ? "start" : "stop");
+			if (ioctl(vpu_dec->vpu_fd, VPU_IOC_SKIP, skip))
+				GST_WARNING_OBJECT(vpu_dec, "VPU_IOC_SKIP failed: %s",
+						strerror(errno));
+			else
+				vpu_dec->skip_state = skip;
+		}
+
+		return gst_pad_push_event(vpu_dec->sinkpad, event);
+	case GST_EVENT_SEEK:
+		if (mfw_gst_vpudec_cache_seek(vpu_dec, event)) {
+			gst_event_unref(event);
+			return TRUE;
+		}
+		return gst_pad_event_default(pad, event);
+	default:
+		return gst_pad_event_default(pad, event);
+	}
+}
+
+/*
+ * The decoder holds back as many pictures as the firmware needs for
+ * reordering. Unless complete pictures are written, the VPU also has to
+ * see the start of the next picture before it can decode one.
+ */
+static gboolean
+mfw_gst_vpudec_src_query(GstPad * pad, GstQuery * query)
+{
+	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(gst_pad_get_parent(pad));
+	GstClockTime min, max, latency;
+	gboolean live, res;
+	gint frames;
+
+	switch (GST_QUERY_TYPE(query)) {
+	case GST_QUERY_LATENCY:
+		res = gst_pad_peer_query(vpu_dec->sinkpad, query);
+		if (!res)
+			break;
+		gst_query_parse_latency(query, &live, &min, &max);
+
+		frames = vpu_dec->init ?
+			ioctl(vpu_dec->vpu_fd, VPU_IOC_FRAME_DELAY) : 0;
+		if (frames < 0)
+			frames = 0;
+		if (vpu_dec->codec == STD_MPEG2 || vpu_dec->codec == STD_H263)
+			frames++;
+
+		latency = 0;
+		if (vpu_dec->frame_rate_nu > 0 && vpu_dec->frame_rate_de > 0)
+			latency = gst_util_uint64_scale(frames * GST_SECOND,
+					vpu_dec->frame_rate_de,
+					vpu_dec->frame_rate_nu);
+
+		GST_DEBUG_OBJECT(vpu_dec, "latency %d frames, %" GST_TIME_FORMAT,
+				frames, GST_TIME_ARGS(latency));
+
+		min += latency;
+		if (GST_CLOCK_TIME_IS_VALID(max))
+			max += latency;
+		gst_query_set_latency(query, live, min, max);
+		break;
+	default:
+		res = gst_pad_query_default(pad, query);
+		break;
+	}
+
+	gst_object_unref(vpu_dec);
+	return res;
+}
+
 static GstStateChangeReturn
 mfw_gst_vpudec_change_state(GstElement * element, GstStateChange transition)
 {
@@ -732,9 +3951,45 @@ mfw_gst_vpudec_change_state(GstElement * element, GstStateChange transition)
 			return GST_STATE_CHANGE_FAILURE;
 		}
 
+		if (pipe(vpu_dec->wakeup_fd)) {
+			GST_ERROR("creating wakeup pipe failed: %d", errno);
+			close(vpu_dec->vpu_fd);
+			vpu_dec->vpu_fd = -1;
+			return GST_STATE_CHANGE_FAILURE;
+		}
+		g_mutex_lock(vpu_dec->buf_lock);
+		vpu_dec->flushing = FALSE;
+		g_mutex_unlock(vpu_dec->buf_lock);
+
 		break;
 	case GST_STATE_CHANGE_READY_TO_PAUSED:
 		vpu_dec->init = FALSE;
+		vpu_dec->pool_hits = 0;
+		vpu_dec->pool_misses = 0;
+		vpu_dec->has_pts = FALSE;
+		mfw_gst_vpudec_clear_timestamps(vpu_dec);
+		vpu_dec->eos = FALSE;
+		vpu_dec->draining = FALSE;
+		vpu_dec->seq_width = vpu_dec->seq_height = 0;
+		vpu_dec->jpeg_422 = FALSE;
+		vpu_dec->trick_mode = FALSE;
+		vpu_dec->iframe_state = -1;
+		vpu_dec->skip_state = -1;
+		vpu_dec->low_delay_state = -1;
+		vpu_dec->output_flow = GST_FLOW_OK;
+		gst_segment_init(&vpu_dec->segment, GST_FORMAT_TIME);
+		mfw_gst_vpudec_set_flushing(vpu_dec, FALSE);
+		vpu_dec->input_queued = vpu_dec->input_high > 0;
+		vpu_dec->input_flushing = FALSE;
+		vpu_dec->input_flow = GST_FLOW_OK;
+		break;
+	case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+		/* hold the next picture rendered into the framebuffer */
+		g_mutex_lock(vpu_dec->buf_lock);
+		vpu_dec->state = GST_STATE_PAUSED;
+		if (vpu_dec->clock_id)
+			gst_clock_id_unschedule(vpu_dec->clock_id);
+		g_mutex_unlock(vpu_dec->buf_lock);
 		break;
 	default:
 		break;
@@ -746,19 +4001,34 @@ mfw_gst_vpudec_change_state(GstElement * element, GstStateChange transition)
 	case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
 		break;
 	case GST_STATE_CHANGE_PAUSED_TO_READY:
+		if (vpu_dec->pool_hits + vpu_dec->pool_misses)
+			GST_INFO_OBJECT(vpu_dec, "buffer pool hit rate: %" G_GUINT64_FORMAT
+					"/%" G_GUINT64_FORMAT " frames",
+					vpu_dec->pool_hits,
+					vpu_dec->pool_hits + vpu_dec->pool_misses);
 		vpu_dec->decoded_frames=0;
+		mfw_gst_vpudec_reset_au(vpu_dec);
+		mfw_gst_vpudec_clear_cache(vpu_dec);
+		vpu_dec->reverse_gop = FALSE;
+		mfw_gst_vpudec_canvas_retire(vpu_dec);
 		break;
 	case GST_STATE_CHANGE_READY_TO_NULL:
 		mfw_gst_vpudec_buffers_unref(vpu_dec);
 		retval = close(vpu_dec->vpu_fd);
 		if(retval)
 			GST_ERROR("closing filedesriptor error: %d\n", errno);
+		vpu_dec->vpu_fd = -1;
+		close(vpu_dec->wakeup_fd[0]);
+		close(vpu_dec->wakeup_fd[1]);
 		break;
 	default:
 		break;
 	}
 
+	g_mutex_lock(vpu_dec->buf_lock);
 	vpu_dec->state = next;
+	g_cond_broadcast(vpu_dec->drain_cond);
+	g_mutex_unlock(vpu_dec->buf_lock);
 
 	return ret;
 
@@ -797,6 +4067,54 @@ static GstPadTemplate *src_templ(void)
 	return templ;
 }
 
+static gboolean mfw_gst_vpudec_has_codec(GstVPU_Dec *vpu_dec, gint codec)
+{
+	return ioctl(vpu_dec->vpu_fd, VPU_IOC_HAS_CODEC, codec) == 0;
+}
+
+/*
+ * The sink template lists every codec of the i.MX5 VPU. Once the device
+ * is open the ones it can't decode are left out, MPEG-2, VC-1, DivX 3
+ * and RealVideo aren't there on the i.MX27.
+ */
+static GstCaps *mfw_gst_vpudec_getcaps(GstPad *pad)
+{
+	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(gst_pad_get_parent(pad));
+	GstCaps *caps = gst_caps_copy(gst_pad_get_pad_template_caps(pad));
+	GstStructure *structure;
+	guint i = 0;
+
+	if (vpu_dec->vpu_fd < 0) {
+		gst_object_unref(vpu_dec);
+		return caps;
+	}
+
+	while (i < gst_caps_get_size(caps)) {
+		structure = gst_caps_get_structure(caps, i);
+
+		if (gst_structure_has_name(structure, "video/mpeg")) {
+			if (!mfw_gst_vpudec_has_codec(vpu_dec, STD_MPEG2))
+				gst_structure_set(structure, "mpegversion",
+						G_TYPE_INT, 4, NULL);
+		} else if (gst_structure_has_name(structure, "video/x-divx")) {
+			if (!mfw_gst_vpudec_has_codec(vpu_dec, STD_DIV3))
+				gst_structure_set(structure, "divxversion",
+						GST_TYPE_INT_RANGE, 4, 5, NULL);
+		} else if ((gst_structure_has_name(structure, "video/x-wmv") &&
+				!mfw_gst_vpudec_has_codec(vpu_dec, STD_VC1)) ||
+				(gst_structure_has_name(structure,
+					"video/x-pn-realvideo") &&
+				!mfw_gst_vpudec_has_codec(vpu_dec, STD_RV))) {
+			gst_caps_remove_structure(caps, i);
+			continue;
+		}
+		i++;
+	}
+
+	gst_object_unref(vpu_dec);
+	return caps;
+}
+
 static gboolean
 mfw_gst_vpudec_setcaps(GstPad * pad, GstCaps * caps)
 {
@@ -808,21 +4126,54 @@ mfw_gst_vpudec_setcaps(GstPad * pad, GstCaps * caps)
 	GValue *codec_data;
 	guint8 *hdrextdata;
 	guint i = 0;
+	gint version = 0, mp4_class = MP4_CLASS_MPEG4;
+	guint32 fourcc = 0;
+
+	/* the queued buffers go with the old caps */
+	mfw_gst_vpudec_input_wait_idle(vpu_dec);
 
-	if (strcmp(mime, "video/x-h264") == 0)
+	if (strcmp(mime, "video/x-h264") == 0) {
 		vpu_dec->codec = STD_AVC;
-	else if (strcmp(mime, "video/mpeg") == 0)
+	} else if (strcmp(mime, "video/mpeg") == 0) {
+		gst_structure_get_int(structure, "mpegversion", &version);
+		vpu_dec->codec = version == 4 ? STD_MPEG4 : STD_MPEG2;
+	} else if (strcmp(mime, "video/x-divx") == 0) {
+		gst_structure_get_int(structure, "divxversion", &version);
+		if (version == 3)
+			vpu_dec->codec = STD_DIV3;
+		else
+			vpu_dec->codec = STD_MPEG4;
+		mp4_class = version == 4 ? MP4_CLASS_DIVX4 : MP4_CLASS_DIVX5;
+	} else if (strcmp(mime, "video/x-xvid") == 0) {
 		vpu_dec->codec = STD_MPEG4;
-	else if (strcmp(mime, "video/x-divx") == 0)
-		vpu_dec->codec = STD_MPEG4;
-	else if (strcmp(mime, "video/x-h263") == 0)
+		mp4_class = MP4_CLASS_XVID;
+	} else if (strcmp(mime, "video/x-h263") == 0) {
 		vpu_dec->codec = STD_H263;
-	else {
+	} else if (strcmp(mime, "image/jpeg") == 0) {
+		vpu_dec->codec = STD_MJPG;
+	} else if (strcmp(mime, "video/x-wmv") == 0) {
+		vpu_dec->codec = STD_VC1;
+		gst_structure_get_fourcc(structure, "format", &fourcc);
+	} else if (strcmp(mime, "video/x-pn-realvideo") == 0) {
+		vpu_dec->codec = STD_RV;
+		gst_structure_get_int(structure, "rmversion", &version);
+	} else {
 		GST_ERROR(" Codec Standard not supporded");
+		gst_object_unref(vpu_dec);
+		return FALSE;
+	}
+
+	/* MPEG-2, VC-1, DivX 3 and RealVideo need the VPU of the i.MX5 */
+	if (ioctl(vpu_dec->vpu_fd, VPU_IOC_CODEC, vpu_dec->codec)) {
+		GST_ERROR_OBJECT(vpu_dec, "%s not supported by the VPU", mime);
+		gst_object_unref(vpu_dec);
 		return FALSE;
 	}
 
-	ioctl(vpu_dec->vpu_fd, VPU_IOC_CODEC, vpu_dec->codec);
+	if (vpu_dec->codec == STD_MPEG4 &&
+			ioctl(vpu_dec->vpu_fd, VPU_IOC_MP4_CLASS, mp4_class))
+		GST_WARNING_OBJECT(vpu_dec, "VPU_IOC_MP4_CLASS failed: %s",
+				strerror(errno));
 
 	gst_structure_get_fraction(structure, "framerate",
 			&vpu_dec->frame_rate_nu, &vpu_dec->frame_rate_de);
@@ -840,9 +4191,133 @@ mfw_gst_vpudec_setcaps(GstPad * pad, GstCaps * caps)
 			vpu_dec->width,
 			vpu_dec->height);
 
+	if (vpu_dec->hdr_ext_data) {
+		gst_buffer_unref(vpu_dec->hdr_ext_data);
+		vpu_dec->hdr_ext_data = NULL;
+	}
+	vpu_dec->avc = FALSE;
+	vpu_dec->vc1_rcv = FALSE;
+	vpu_dec->vc1_ap = FALSE;
+
+	/* parsers in front of us hand out whole access units */
+	if (vpu_dec->codec == STD_AVC) {
+		const gchar *alignment =
+			gst_structure_get_string(structure, "alignment");
+
+		vpu_dec->au_aligned = alignment && !strcmp(alignment, "au");
+	} else {
+		gboolean parsed = FALSE;
+
+		gst_structure_get_boolean(structure, "parsed", &parsed);
+		vpu_dec->au_aligned = parsed;
+	}
+
+	/* H.264 and MPEG-4 tell in their sequence header, see check_seq */
+	mfw_gst_vpudec_set_low_delay(vpu_dec, vpu_dec->codec == STD_MJPG ||
+			vpu_dec->codec == STD_H263 || vpu_dec->codec == STD_DIV3);
+
+	/* DivX 3 has no sequence header to take the picture size from */
+	if (vpu_dec->codec == STD_DIV3) {
+		if (!vpu_dec->width || !vpu_dec->height ||
+				ioctl(vpu_dec->vpu_fd, VPU_IOC_SRC_SIZE,
+				vpu_dec->width << 16 | vpu_dec->height)) {
+			GST_ERROR_OBJECT(vpu_dec, "no picture size for DivX 3");
+			gst_object_unref(vpu_dec);
+			return FALSE;
+		}
+	}
+
 	codec_data = (GValue *) gst_structure_get_value(structure, "codec_data");
-	if (codec_data) {
-		vpu_dec->hdr_ext_data = gst_value_get_buffer(codec_data);
+	if (vpu_dec->codec == STD_AVC) {
+		const gchar *stream_format =
+			gst_structure_get_string(structure, "stream-format");
+		GstBuffer *avcc = codec_data ?
+			gst_value_get_buffer(codec_data) : NULL;
+
+		/* demuxers predating stream-format only set the avcC */
+		if (stream_format)
+			vpu_dec->avc = !strcmp(stream_format, "avc");
+		else
+			vpu_dec->avc = avcc && GST_BUFFER_SIZE(avcc) &&
+				GST_BUFFER_DATA(avcc)[0] == 1;
+
+		/*
+		 * Without an h264parse in front of us the stream comes as
+		 * avc. The VPU only understands byte-stream, so the SPS and
+		 * PPS are taken from the avcC record here and the NAL unit
+		 * lengths are replaced while writing.
+		 */
+		if (vpu_dec->avc) {
+			if (avcc)
+				vpu_dec->hdr_ext_data = mfw_gst_vpu_avcc_to_annexb(
+						GST_BUFFER_DATA(avcc),
+						GST_BUFFER_SIZE(avcc),
+						&vpu_dec->nal_length_size);
+			if (!vpu_dec->hdr_ext_data) {
+				GST_ERROR_OBJECT(vpu_dec, "avc stream without a valid avcC");
+				vpu_dec->avc = FALSE;
+				gst_object_unref(vpu_dec);
+				return FALSE;
+			}
+			GST_DEBUG_OBJECT(vpu_dec, "avc stream, NAL length size %d",
+					vpu_dec->nal_length_size);
+		} else if (avcc) {
+			vpu_dec->hdr_ext_data = gst_buffer_ref(avcc);
+		}
+	} else if (vpu_dec->codec == STD_VC1 &&
+			(fourcc == GST_MAKE_FOURCC('W', 'V', 'C', '1') ||
+			 fourcc == GST_MAKE_FOURCC('W', 'M', 'V', 'A'))) {
+		/* advanced profile, the codec data holds the sequence header */
+		vpu_dec->vc1_ap = TRUE;
+		if (codec_data) {
+			GstBuffer *seq = gst_value_get_buffer(codec_data);
+			gint ofs = mfw_gst_vpu_find_start_code(GST_BUFFER_DATA(seq),
+					GST_BUFFER_SIZE(seq));
+
+			if (ofs >= 0)
+				vpu_dec->hdr_ext_data = gst_buffer_create_sub(seq,
+						ofs, GST_BUFFER_SIZE(seq) - ofs);
+		}
+	} else if (vpu_dec->codec == STD_VC1) {
+		/* simple and main profile go into an RCV container */
+		GstBuffer *struct_c = codec_data ?
+			gst_value_get_buffer(codec_data) : NULL;
+
+		if (struct_c)
+			vpu_dec->hdr_ext_data = mfw_gst_vpu_vc1_rcv_header(
+					GST_BUFFER_DATA(struct_c),
+					GST_BUFFER_SIZE(struct_c),
+					vpu_dec->width, vpu_dec->height,
+					(gint)vpu_dec->frame_rate);
+		if (!vpu_dec->hdr_ext_data) {
+			GST_ERROR_OBJECT(vpu_dec, "no sequence layer for VC-1");
+			gst_object_unref(vpu_dec);
+			return FALSE;
+		}
+		vpu_dec->vc1_rcv = TRUE;
+	} else if (vpu_dec->codec == STD_RV) {
+		GstBuffer *extra = codec_data ?
+			gst_value_get_buffer(codec_data) : NULL;
+
+		vpu_dec->hdr_ext_data = mfw_gst_vpu_rv_seq_header(version,
+				vpu_dec->width, vpu_dec->height,
+				vpu_dec->frame_rate_nu, vpu_dec->frame_rate_de,
+				extra ? GST_BUFFER_DATA(extra) : NULL,
+				extra ? GST_BUFFER_SIZE(extra) : 0);
+		vpu_dec->rv_seq = 0;
+	} else if (codec_data) {
+		vpu_dec->hdr_ext_data = gst_buffer_ref(gst_value_get_buffer(codec_data));
+	}
+
+	/* don't wait for the VPU to find the sequence header */
+	if (vpu_dec->hdr_ext_data && !vpu_dec->init)
+		mfw_gst_vpudec_check_seq(vpu_dec,
+				GST_BUFFER_DATA(vpu_dec->hdr_ext_data),
+				GST_BUFFER_SIZE(vpu_dec->hdr_ext_data));
+
+	if (vpu_dec->hdr_ext_data) {
+		/* new codec data, e.g. of another rendition, goes out first */
+		vpu_dec->once = 0;
 		vpu_dec->hdr_ext_data_len = GST_BUFFER_SIZE(vpu_dec->hdr_ext_data);
 		GST_DEBUG("Codec specific data length is %d", vpu_dec->hdr_ext_data_len);
 		GST_DEBUG("Header Extension Data is");
@@ -889,6 +4364,28 @@ mfw_gst_vpudec_mirror_get_type(void)
 	return vpudec_mirror_type;
 }
 
+static void
+mfw_gst_vpudec_finalize(GObject * object)
+{
+	GstVPU_Dec *vpu_dec = MFW_GST_VPU_DEC(object);
+
+	g_mutex_free(vpu_dec->buf_lock);
+	g_cond_free(vpu_dec->drain_cond);
+	g_object_unref(vpu_dec->adapter);
+	if (vpu_dec->hdr_ext_data)
+		gst_buffer_unref(vpu_dec->hdr_ext_data);
+	g_free(vpu_dec->device);
+	g_free(vpu_dec->fb_device);
+	g_free(vpu_dec->canvas_name);
+	mfw_gst_vpu_cache_clear(&vpu_dec->cache);
+	gst_object_unref(vpu_dec->input_task);
+	g_static_rec_mutex_free(&vpu_dec->input_task_lock);
+	g_mutex_free(vpu_dec->input_lock);
+	g_cond_free(vpu_dec->input_cond);
+
+	G_OBJECT_CLASS(vpu_dec->parent_class)->finalize(object);
+}
+
 static void
 mfw_gst_vpudec_class_init(GstVPU_DecClass * klass)
 {
@@ -900,6 +4397,7 @@ mfw_gst_vpudec_class_init(GstVPU_DecClass * klass)
 	gstelement_class->change_state = mfw_gst_vpudec_change_state;
 	gobject_class->set_property = mfw_gst_vpudec_set_property;
 	gobject_class->get_property = mfw_gst_vpudec_get_property;
+	gobject_class->finalize = mfw_gst_vpudec_finalize;
 
 	mfw_gst_vpu_class_init_common(gobject_class);
 
@@ -939,6 +4437,118 @@ mfw_gst_vpudec_class_init(GstVPU_DecClass * klass)
 							 G_MININT, G_MAXINT, 5,
 							 G_PARAM_READWRITE));
 
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_PUSH_LIST,
+					g_param_spec_boolean("push-list",
+							     "push-list",
+							     "push all decoded frames ready at once as a buffer list",
+							     FALSE,
+							     G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_CAPTURE_BUFFERS,
+					g_param_spec_uint("capture-buffers",
+							  "capture-buffers",
+							  "number of decoded picture buffers, 0 sizes the queue from the stream's reorder delay and downstream latency",
+							  0, MAX_BUFFERS, 0,
+							  G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_KEYFRAME_ONLY,
+					g_param_spec_boolean("keyframe-only",
+							     "keyframe-only",
+							     "decode intra pictures only, also done for segments with a rate beyond 2x",
+							     FALSE,
+							     G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_LOW_LATENCY,
+					g_param_spec_boolean("low-latency",
+							     "low-latency",
+							     "output pictures as soon as they are decoded if the stream has no B pictures",
+							     FALSE,
+							     G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_CANVAS,
+					g_param_spec_string("canvas",
+							    "canvas",
+							    "name of a canvas shared with up to 4 decoders, one per VPU instance, to compose a mosaic in",
+							    NULL,
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_CANVAS_SIZE,
+					g_param_spec_string("canvas-size",
+							    "canvas-size",
+							    "size of the canvas as widthxheight, multiples of 16 and 2",
+							    "0x0",
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_CANVAS_TILE,
+					g_param_spec_string("canvas-tile",
+							    "canvas-tile",
+							    "position of the pictures in the canvas as x,y, multiples of 16 and 2",
+							    "0,0",
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_CROP_WINDOW,
+					g_param_spec_string("crop-window",
+							    "crop-window",
+							    "part of the pictures to output as left,top,width,height, reported as crop in the source caps",
+							    NULL,
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_OUTPUT_INTERVAL,
+					g_param_spec_uint("output-interval",
+							  "output-interval",
+							  "output only every nth decoded picture, the others are decoded as references without being written out",
+							  1, G_MAXUINT16, 1,
+							  G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_FRAME_CACHE_SIZE,
+					g_param_spec_uint("frame-cache-size",
+							  "frame-cache-size",
+							  "bytes of decoded pictures kept to serve seeks back to them without decoding again, 0 to disable",
+							  0, G_MAXUINT, 0,
+							  G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_INPUT_QUEUE_HIGH,
+					g_param_spec_uint("input-queue-high",
+							  "input-queue-high",
+							  "bytes of bitstream queued for the VPU before upstream waits, 0 to write from the upstream thread, applied when going to PAUSED",
+							  0, G_MAXUINT, INPUT_QUEUE_HIGH,
+							  G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_INPUT_QUEUE_LOW,
+					g_param_spec_uint("input-queue-low",
+							  "input-queue-low",
+							  "bytes of bitstream queued at which a waiting upstream resumes",
+							  0, G_MAXUINT, INPUT_QUEUE_LOW,
+							  G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_EXPORT_DMABUF,
+					g_param_spec_boolean("export-dmabuf",
+							     "export-dmabuf",
+							     "push capture buffers exported as dmabuf, announced by the dmabuf caps field",
+							     FALSE,
+							     G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_FB_DEVICE,
+					g_param_spec_string("fb-device",
+							    "fb-device",
+							    "overlay framebuffer to decode into and display on instead of pushing the pictures, e.g. /dev/fb1",
+							    NULL,
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_POOL_HITS,
+					g_param_spec_uint64("pool-hits",
+							    "pool-hits",
+							    "number of frames pushed in a capture buffer without copying",
+							    0, G_MAXUINT64, 0,
+							    G_PARAM_READABLE));
+
+	g_object_class_install_property(gobject_class, MFW_GST_VPU_POOL_MISSES,
+					g_param_spec_uint64("pool-misses",
+							    "pool-misses",
+							    "number of frames copied because all capture buffers were held downstream",
+							    0, G_MAXUINT64, 0,
+							    G_PARAM_READABLE));
+
 }
 
 static void
@@ -957,15 +4567,48 @@ mfw_gst_vpudec_init(GstVPU_Dec * vpu_dec, GstVPU_DecClass * gclass)
 
 	gst_pad_set_chain_function(vpu_dec->sinkpad,
 				   mfw_gst_vpudec_chain_stream_mode);
+	gst_pad_set_chain_list_function(vpu_dec->sinkpad,
+				   mfw_gst_vpudec_chain_list);
 	gst_pad_set_setcaps_function(vpu_dec->sinkpad, mfw_gst_vpudec_setcaps);
+	gst_pad_set_getcaps_function(vpu_dec->sinkpad, mfw_gst_vpudec_getcaps);
 	gst_pad_set_event_function(vpu_dec->sinkpad,
 				   GST_DEBUG_FUNCPTR
 				   (mfw_gst_vpudec_sink_event));
+	gst_pad_set_event_function(vpu_dec->srcpad,
+				   GST_DEBUG_FUNCPTR
+				   (mfw_gst_vpudec_src_event));
+	gst_pad_set_query_function(vpu_dec->srcpad,
+				   GST_DEBUG_FUNCPTR
+				   (mfw_gst_vpudec_src_query));
+	gst_pad_set_activatepush_function(vpu_dec->srcpad,
+				   GST_DEBUG_FUNCPTR
+				   (mfw_gst_vpudec_src_activate_push));
+	gst_pad_set_activatepush_function(vpu_dec->sinkpad,
+				   GST_DEBUG_FUNCPTR
+				   (mfw_gst_vpudec_sink_activate_push));
 
 	vpu_dec->rotation_angle = 0;
 	vpu_dec->mirror_dir = MIRDIR_NONE;
 	vpu_dec->codec = STD_AVC;
 	vpu_dec->device = g_strdup(VPU_DEVICE);
+	vpu_dec->vpu_fd = -1;
+	vpu_dec->buf_lock = g_mutex_new();
+	vpu_dec->drain_cond = g_cond_new();
+	vpu_dec->adapter = gst_adapter_new();
+	vpu_dec->fb_shown = -1;
+	vpu_dec->output_interval = 1;
+	vpu_dec->interval_state = 1;
+	mfw_gst_vpu_cache_init(&vpu_dec->cache, 0);
+
+	vpu_dec->input_high = INPUT_QUEUE_HIGH;
+	vpu_dec->input_low = INPUT_QUEUE_LOW;
+	vpu_dec->input_lock = g_mutex_new();
+	vpu_dec->input_cond = g_cond_new();
+	g_queue_init(&vpu_dec->input_queue);
+	g_static_rec_mutex_init(&vpu_dec->input_task_lock);
+	vpu_dec->input_task = gst_task_create(
+			(GstTaskFunction) mfw_gst_vpudec_input_loop, vpu_dec);
+	gst_task_set_lock(vpu_dec->input_task, &vpu_dec->input_task_lock);
 
 	vpu_dec->dbk_enabled = FALSE;
 	vpu_dec->dbk_offset_a = vpu_dec->dbk_offset_b = DEFAULT_DBK_OFFSET_VALUE;
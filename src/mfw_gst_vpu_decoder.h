@@ -32,10 +32,21 @@
 #ifndef __MFW_GST_VPU_DECODER_H__
 #define __MFW_GST_VPU_DECODER_H__
 
+#include <sys/uio.h>
 #include <linux/videodev2.h>
 #include "mfw_gst_utils.h"
 
-#define NUM_BUFFERS 2
+/*
+ * With export-dmabuf the src caps carry "dmabuf = (boolean) true". Each
+ * pushed buffer then has a dmabuf fd of its picture in GST_BUFFER_OFFSET,
+ * GST_BUFFER_OFFSET_NONE if exporting it failed. The fd belongs to the
+ * buffer and is closed when it is freed, importers dup() it to keep it.
+ */
+#define MFW_GST_VPUDEC_DMABUF_FIELD	"dmabuf"
+
+/* capture buffers, the actual number depends on the stream */
+#define MIN_BUFFERS 2
+#define MAX_BUFFERS 16
 
 G_BEGIN_DECLS
 #define MFW_GST_TYPE_VPU_DEC (mfw_gst_type_vpu_dec_get_type())
@@ -71,6 +82,44 @@ GType mfw_gst_vpudec_codec_get_type(void);
 #define	VPU_IOC_MAGIC		'V'
 #define	VPU_IOC_ROTATE_MIRROR	_IO(VPU_IOC_MAGIC, 7)
 #define VPU_IOC_CODEC		_IO(VPU_IOC_MAGIC, 8)
+#define VPU_IOC_FRAME_DELAY	_IO(VPU_IOC_MAGIC, 10)
+#define VPU_IOC_PTS		_IOW(VPU_IOC_MAGIC, 11, struct timeval)
+#define VPU_IOC_SKIP		_IO(VPU_IOC_MAGIC, 12)
+#define VPU_IOC_FLUSH		_IO(VPU_IOC_MAGIC, 13)
+#define VPU_IOC_PIC_END		_IO(VPU_IOC_MAGIC, 14)
+#define VPU_IOC_SEQ_CHANGE	_IO(VPU_IOC_MAGIC, 15)
+#define VPU_IOC_MP4_CLASS	_IO(VPU_IOC_MAGIC, 16)
+#define VPU_IOC_SRC_SIZE	_IO(VPU_IOC_MAGIC, 17)
+#define VPU_IOC_IFRAME_ONLY	_IO(VPU_IOC_MAGIC, 18)
+#define VPU_IOC_LOW_LATENCY	_IO(VPU_IOC_MAGIC, 19)
+#define VPU_IOC_OUTPUT_INTERVAL	_IO(VPU_IOC_MAGIC, 20)
+#define VPU_IOC_CANVAS		_IOW(VPU_IOC_MAGIC, 21, struct vpu_canvas)
+
+/* the decoded pictures are written to a tile of a larger canvas */
+struct vpu_canvas {
+	__u32 x, y;		/* position of the tile */
+	__u32 width, height;	/* canvas size, 0 for a picture per buffer */
+};
+
+#define VPU_IOC_SEQ_HINT	_IOW(VPU_IOC_MAGIC, 22, struct vpu_seq_hint)
+
+/* the sequence as parsed by userspace before the VPU has seen it */
+struct vpu_seq_hint {
+	__u32 width, height;	/* coded size, multiples of 16 */
+	__u32 num_ref_frames;
+	struct v4l2_rect visible;
+};
+
+#define VPU_IOC_WRITEV		_IOWR(VPU_IOC_MAGIC, 23, struct vpu_writev)
+
+/* bitstream in pieces, written as far as it fits like with write() */
+struct vpu_writev {
+	struct iovec *iov;
+	__u32 count;
+	__u32 written;		/* returned: bytes taken from the start */
+};
+
+#define VPU_IOC_HAS_CODEC	_IO(VPU_IOC_MAGIC, 24)
 
 G_END_DECLS
 #endif				/* __MFW_GST_VPU_DECODER_H__ */
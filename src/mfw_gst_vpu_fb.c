@@ -0,0 +1,131 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Module Name:    mfw_gst_vpu_fb.c
+ *
+ * Description:    Overlay framebuffer pages the VPU decoder renders into
+ *
+ * Portability:    This code is written for Linux OS and Gstreamer
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <gst/gst.h>
+#include "mxcfb.h"
+#include "mfw_gst_vpu_fb.h"
+
+/*
+ * The IPU overlay takes YUV formats by their fourcc in nonstd. The pages
+ * are stacked in the virtual resolution, one picture high each, so that
+ * panning to a page is all it takes to show it.
+ */
+MfwGstVpuFb *mfw_gst_vpu_fb_open(const gchar *device, guint32 fourcc,
+		gint width, gint height, guint frame_size, guint count)
+{
+	struct fb_fix_screeninfo fix;
+	struct mxcfb_pos pos = { 0, 0 };
+	MfwGstVpuFb *fb;
+	void *mem;
+
+	fb = g_new0(MfwGstVpuFb, 1);
+
+	fb->fd = open(device, O_RDWR);
+	if (fb->fd < 0)
+		goto err_free;
+
+	if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &fb->saved))
+		goto err_close;
+
+	fb->var = fb->saved;
+	fb->var.xres = fb->var.xres_virtual = width;
+	fb->var.yres = height;
+	fb->var.yres_virtual = height * count;
+	fb->var.xoffset = fb->var.yoffset = 0;
+	fb->var.nonstd = fourcc;
+	fb->var.bits_per_pixel =
+		fourcc == GST_MAKE_FOURCC('Y', '4', '2', 'B') ? 16 : 12;
+	fb->var.activate = FB_ACTIVATE_NOW | FB_ACTIVATE_FORCE;
+
+	if (ioctl(fb->fd, FBIOPUT_VSCREENINFO, &fb->var))
+		goto err_close;
+
+	if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &fb->var) ||
+			ioctl(fb->fd, FBIOGET_FSCREENINFO, &fix))
+		goto err_restore;
+
+	/* the driver may have rounded the mode */
+	if (fb->var.nonstd != fourcc || fb->var.xres != width ||
+			fb->var.yres != height)
+		goto err_restore;
+
+	fb->page_size = fix.line_length * height;
+	fb->count = count;
+	fb->mem_size = fix.smem_len;
+	if (fb->page_size < frame_size || fb->mem_size < fb->page_size * count)
+		goto err_restore;
+
+	mem = mmap(NULL, fb->mem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fb->fd, 0);
+	if (mem == MAP_FAILED)
+		goto err_restore;
+	fb->mem = mem;
+
+	/* not an error for framebuffers other than the overlay */
+	ioctl(fb->fd, MXCFB_SET_OVERLAY_POS, &pos);
+	ioctl(fb->fd, FBIOBLANK, FB_BLANK_UNBLANK);
+
+	return fb;
+
+err_restore:
+	ioctl(fb->fd, FBIOPUT_VSCREENINFO, &fb->saved);
+err_close:
+	close(fb->fd);
+err_free:
+	g_free(fb);
+
+	return NULL;
+}
+
+guint8 *mfw_gst_vpu_fb_page(MfwGstVpuFb *fb, guint n)
+{
+	return fb->mem + n * fb->page_size;
+}
+
+gboolean mfw_gst_vpu_fb_flip(MfwGstVpuFb *fb, guint n)
+{
+	guint32 vsync = 0;
+
+	fb->var.yoffset = n * fb->var.yres;
+	if (ioctl(fb->fd, FBIOPAN_DISPLAY, &fb->var))
+		return FALSE;
+
+	/* framebuffers without the ioctl latch the offset immediately */
+	ioctl(fb->fd, MXCFB_WAIT_FOR_VSYNC, &vsync);
+
+	return TRUE;
+}
+
+void mfw_gst_vpu_fb_close(MfwGstVpuFb *fb)
+{
+	munmap(fb->mem, fb->mem_size);
+	ioctl(fb->fd, FBIOPUT_VSCREENINFO, &fb->saved);
+	close(fb->fd);
+	g_free(fb);
+}
@@ -0,0 +1,65 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Module Name:    mfw_gst_vpu_fb.h
+ *
+ * Description:    Overlay framebuffer pages the VPU decoder renders into
+ *
+ * Portability:    This code is written for Linux OS and Gstreamer
+ */
+
+#ifndef __MFW_GST_VPU_FB_H__
+#define __MFW_GST_VPU_FB_H__
+
+#include <gst/gst.h>
+#include <linux/fb.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	int fd;
+	guint8 *mem;		/* mapping of all pages */
+	guint mem_size;
+	guint page_size;	/* distance of the pages in mem */
+	guint count;
+	struct fb_var_screeninfo var;	/* mode used for the pictures */
+	struct fb_var_screeninfo saved;	/* mode restored on close */
+} MfwGstVpuFb;
+
+/*
+ * Switches the overlay framebuffer device to count pages of width x height
+ * pictures in the given YUV format and maps them. Every page has to hold
+ * frame_size bytes. Returns NULL if the device can't do this.
+ */
+MfwGstVpuFb *mfw_gst_vpu_fb_open(const gchar *device, guint32 fourcc,
+		gint width, gint height, guint frame_size, guint count);
+
+/* Start of page n in the mapping */
+guint8 *mfw_gst_vpu_fb_page(MfwGstVpuFb *fb, guint n);
+
+/*
+ * Pans the display to page n and waits for the next vertical sync, after
+ * which the page shown before is no longer scanned out.
+ */
+gboolean mfw_gst_vpu_fb_flip(MfwGstVpuFb *fb, guint n);
+
+/* Unmaps the pages and restores the mode found on open */
+void mfw_gst_vpu_fb_close(MfwGstVpuFb *fb);
+
+G_END_DECLS
+#endif				/* __MFW_GST_VPU_FB_H__ */